@@ -0,0 +1,111 @@
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include "batch.h"
+//Reads one query per line, empty lines and lines starting with # are skipped
+std::vector<std::string> read_queries(const std::string &filename){
+    std::vector<std::string> queries;
+    std::ifstream f(filename);
+    if(!f){
+        throw std::invalid_argument("Unable to open " + filename);
+    }
+    std::string l;
+    while(std::getline(f, l)){
+        if(!l.empty() && l.back() == '\r'){
+            l.pop_back();
+        }
+        if(l.empty() || l[0] == '#'){
+            continue;
+        }
+        queries.push_back(l);
+    }
+    return queries;
+}
+
+//Runs all queries. They are parsed first so every literal is looked up only once,
+//then the queries are handed out to worker threads.
+std::vector<BatchResult> run_batch(const Corpus &corpus, const std::vector<std::string> &queries, const BatchOptions &options){
+    std::vector<BatchResult> results(queries.size());
+    std::vector<Query> parsed(queries.size());
+    for(int i = 0; i < (int)queries.size(); i++){
+        results[i].query = queries[i];
+        results[i].count = 0;
+        results[i].ms = 0;
+        try{
+            parsed[i] = parse_query(queries[i], corpus);
+        } catch(const std::invalid_argument &e){
+            results[i].error = e.what();
+        }
+    }
+    const LookupCache cache = resolve_literals(corpus, parsed);
+    std::atomic<int> next(0);
+    auto worker = [&](){
+        for(int i = next++; i < (int)queries.size(); i = next++){
+            if(!results[i].error.empty()){
+                continue;
+            }
+            auto start = std::chrono::steady_clock::now();
+            QueryBudget budget;
+            budget.time_ms = options.time_ms;
+            budget.memory_bytes = options.memory_bytes;
+            try{
+                BudgetScope scope(budget);
+                QueryPlan plan = plan_query(corpus, parsed[i], &cache);
+                if(options.hits_prefix.empty()){
+                    results[i].count = count_matches(corpus, plan, parsed[i].size());
+                } else{
+                    const char *extension[] = {"jsonl", "tsv", "bin"};
+                    std::string filename = options.hits_prefix + std::to_string(i) + "." + extension[(int)options.format];
+                    std::ofstream out(filename, std::ios::binary);
+                    if(!out){
+                        results[i].error = "Unable to open " + filename;
+                    } else{
+                        MatchExporter exporter(corpus, out, options.format, options.attributes);
+                        results[i].count = export_matches(corpus, plan, parsed[i].size(), exporter);
+                    }
+                }
+            } catch(const std::exception &e){
+                //Budget aborts and any other error fail only this query, escaping the worker thread would terminate the batch
+                results[i].count = 0;
+                results[i].error = e.what();
+            }
+            std::chrono::duration<double, std::milli> d = std::chrono::steady_clock::now() - start;
+            results[i].ms = d.count();
+        }
+    };
+    int threads = options.threads > 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, (int)queries.size());
+    std::vector<std::thread> workers;
+    for(int i = 1; i < threads; i++){
+        workers.emplace_back(worker);
+    }
+    worker();
+    for(std::thread &t: workers){
+        t.join();
+    }
+    return results;
+}
+
+//Writes one tab separated line per query: index, count, milliseconds, query and error if any
+void write_results(std::ostream &out, const std::vector<BatchResult> &results){
+    std::string buffer = "id\tcount\tms\tquery\terror\n";
+    for(int i = 0; i < (int)results.size(); i++){
+        buffer += std::to_string(i) + '\t' + std::to_string(results[i].count) + '\t' + std::to_string(results[i].ms)
+                + '\t' + results[i].query + '\t' + results[i].error + '\n';
+    }
+    out.write(buffer.data(), buffer.size());
+    out.flush();
+}
+
+//Counts the matches of a plan without building them
+long count_matches(const Corpus &corpus, const QueryPlan &plan, int size){
+    long count = 0;
+    SentenceCursor cursor{corpus};
+    Match m;
+    for_each_position(plan, [&](Position t){
+        count += cursor.to_match(t, size, m);
+    });
+    return count;
+}
@@ -0,0 +1,29 @@
+#ifndef BATCH_H
+#define BATCH_H
+#include "query_corpora.h"
+#include "export.h"
+#include <ostream>
+struct BatchOptions
+{
+    //Hits of query N are written to hits_prefix + N + "." + format, no hits are written if empty
+    std::string hits_prefix;
+    ExportFormat format = ExportFormat::jsonl;
+    std::vector<std::string> attributes = {"word"};
+    //0 uses one thread per core
+    int threads = 0;
+    //Wall time and intermediate memory every query may use, 0 for no limit. Queries over either fail with an error.
+    double time_ms = 0;
+    long memory_bytes = 0;
+};
+struct BatchResult
+{
+    std::string query;
+    long count;
+    double ms;
+    std::string error;
+};
+std::vector<std::string> read_queries(const std::string &filename);
+std::vector<BatchResult> run_batch(const Corpus &corpus, const std::vector<std::string> &queries, const BatchOptions &options);
+void write_results(std::ostream &out, const std::vector<BatchResult> &results);
+long count_matches(const Corpus &corpus, const QueryPlan &plan, int size);
+#endif
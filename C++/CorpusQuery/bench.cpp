@@ -0,0 +1,683 @@
+#include "query_corpora.h"
+#include "suffix_array.h"
+#include "estimate.h"
+#include "batch.h"
+#include "placement.h"
+#include "groups.h"
+#include "views.h"
+#include "footprint.h"
+#include "segments.h"
+#include <unordered_map>
+#include <map>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <cstring>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+//Benchmark suite: times loading, index building and every stage of querying over a fixed workload
+//built from the corpus itself. Prints a table and writes one JSON object per line to a results file.
+//Usage: bench [corpus.csv] [--runs N] [--json FILE]
+
+//Index builder from the older version, a stable sort per attribute
+Index build_index_sort(const std::vector<Token> &tokens, uint32_t Token::* attribute){
+    Index index(tokens.size());
+    for(Position i = 0; i < (Position)tokens.size(); i++){
+        index[i] = i;
+    }
+    std::stable_sort(index.begin(), index.end(), [attribute, &tokens](Position a, Position b) {
+        return tokens[a].*attribute < tokens[b].*attribute;
+    });
+    return index;
+}
+
+struct Timings
+{
+    std::string stage;
+    std::string query_class;
+    std::vector<double> ms;
+    long items = 0;
+};
+std::vector<Timings> results;
+
+//Counts the data TLB misses of loads on this thread from its creation, unavailable where perf events are not allowed
+struct TlbCounter
+{
+    int fd;
+    TlbCounter(){
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    ~TlbCounter(){
+        if(fd >= 0){
+            close(fd);
+        }
+    }
+    //Misses so far, -1 if unavailable
+    long misses(){
+        long count = -1;
+        if(fd < 0 || ::read(fd, &count, sizeof(count)) != sizeof(count)){
+            return -1;
+        }
+        return count;
+    }
+};
+
+//Runs f and returns its time in milliseconds
+template <typename F>
+double time_ms(F f){
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double, std::milli> d = std::chrono::steady_clock::now() - start;
+    return d.count();
+}
+
+//Adds a timing to the results, grouped by stage and query class
+void record(const std::string &stage, const std::string &query_class, double ms, long items){
+    for(Timings &t: results){
+        if(t.stage == stage && t.query_class == query_class){
+            t.ms.push_back(ms);
+            t.items += items;
+            return;
+        }
+    }
+    results.push_back(Timings{stage, query_class, {ms}, items});
+}
+
+double percentile(std::vector<double> v, double p){
+    std::sort(v.begin(), v.end());
+    return v[(size_t)std::ceil((v.size() - 1) * p)];
+}
+
+//Values of an attribute ordered from most to least frequent, values that can not be written in a query are left out
+std::vector<uint32_t> by_frequency(const Corpus &c, uint32_t Token::* attribute){
+    std::vector<int> counts(c.index2string.size(), 0);
+    for(const Token &t: c.tokens){
+        counts[t.*attribute]++;
+    }
+    std::vector<uint32_t> values;
+    for(uint32_t v = 0; v < counts.size(); v++){
+        const std::string &s = c.index2string[v];
+        if(counts[v] > 0 && !s.empty() && s.find_first_of("\"]") == std::string::npos){
+            values.push_back(v);
+        }
+    }
+    std::stable_sort(values.begin(), values.end(), [&counts](uint32_t a, uint32_t b){ return counts[a] > counts[b]; });
+    return values;
+}
+
+std::string literal(const Corpus &c, const std::string &attribute, uint32_t value, bool equal = true){
+    return attribute + (equal ? "=\"" : "!=\"") + c.index2string[value] + "\"";
+}
+
+//Writes literals as one clause
+std::string clause(std::initializer_list<std::string> literals){
+    std::string s = "[";
+    for(const std::string &l: literals){
+        if(s.size() > 1){
+            s += ' ';
+        }
+        s += l;
+    }
+    s += "] ";
+    return s;
+}
+
+//Builds the query workload from frequent, medium and rare values of the corpus
+std::vector<std::pair<std::string, std::string>> workload(const Corpus &c){
+    std::vector<uint32_t> words = by_frequency(c, &Token::word);
+    std::vector<uint32_t> lemmas = by_frequency(c, &Token::lemma);
+    std::vector<uint32_t> pos = by_frequency(c, &Token::pos);
+    std::vector<uint32_t> c5 = by_frequency(c, &Token::c5);
+    auto at = [](const std::vector<uint32_t> &v, double rank){ return v[std::min(v.size() - 1, (size_t)(rank * (v.size() - 1)))]; };
+    uint32_t frequent_word = at(words, 0), medium_word = at(words, 0.01), rare_word = at(words, 0.9);
+    uint32_t frequent_lemma = at(lemmas, 0), rare_lemma = at(lemmas, 0.9);
+    uint32_t frequent_pos = at(pos, 0), second_pos = at(pos, 0.2), frequent_c5 = at(c5, 0);
+    std::vector<std::pair<std::string, std::string>> queries = {
+        {"single", clause({literal(c, "word", frequent_word)})},
+        {"single", clause({literal(c, "word", medium_word)})},
+        {"single", clause({literal(c, "lemma", rare_lemma)})},
+        {"single", clause({literal(c, "pos", frequent_pos)})},
+        {"conjunction", clause({literal(c, "word", rare_word), literal(c, "pos", frequent_pos)})},
+        {"conjunction", clause({literal(c, "lemma", rare_lemma)}) + clause({literal(c, "word", frequent_word)})},
+        {"conjunction", clause({literal(c, "word", frequent_word)}) + clause({literal(c, "word", medium_word)})},
+        {"conjunction", clause({literal(c, "lemma", frequent_lemma), literal(c, "c5", frequent_c5)})},
+        {"complement", clause({literal(c, "pos", frequent_pos, false)})},
+        {"complement", clause({literal(c, "word", frequent_word, false)}) + clause({literal(c, "pos", second_pos)})},
+        {"complement", clause({literal(c, "lemma", frequent_lemma), literal(c, "pos", second_pos, false)})},
+        {"unselective", clause({literal(c, "pos", frequent_pos, false)}) + clause({literal(c, "c5", frequent_c5)}) + clause({literal(c, "pos", second_pos)})},
+        {"unselective", clause({literal(c, "pos", frequent_pos, false)}) + clause({literal(c, "pos", second_pos, false)})},
+        {"folded", "[word=i\"" + c.index2string[frequent_word] + "\"]"},
+        {"folded", "[lemma=i\"" + c.index2string[rare_lemma] + "\"] [word=i\"" + c.index2string[frequent_word] + "\"]"},
+        {"empty", "[]"},
+        {"empty", clause({}) + clause({literal(c, "word", medium_word)})},
+        {"empty", clause({literal(c, "word", frequent_word)}) + clause({}) + clause({literal(c, "pos", second_pos)})},
+    };
+    //Long sequences are copied from sentences in the corpus so they always have matches
+    int added = 0;
+    for(int s = 0; s + 1 < (int)c.sentences.size() && added < 4; s += 97){
+        Position first = c.sentences[s];
+        if(c.sentences[s + 1] - first < 8){
+            continue;
+        }
+        std::string by_word, mixed;
+        bool writable = true;
+        for(Position i = first; i < first + 8; i++){
+            const Token &t = c.tokens[i];
+            writable = writable && c.index2string[t.word].find_first_of("\"]") == std::string::npos
+                                && c.index2string[t.lemma].find_first_of("\"]") == std::string::npos;
+            by_word += clause({literal(c, "word", t.word)});
+            mixed += (i % 2 == 0) ? clause({literal(c, "pos", t.pos)}) : clause({literal(c, "lemma", t.lemma)});
+        }
+        if(writable){
+            queries.push_back({"long", by_word});
+            queries.push_back({"long", mixed});
+            added++;
+        }
+    }
+    return queries;
+}
+
+//Queries with 3 to 10 positive literals copied from sentences, clauses alternate between a part of
+//speech and a lemma so the posting lists range from very frequent to rare
+std::vector<std::pair<int, std::string>> conjunctions(const Corpus &c){
+    std::vector<std::pair<int, std::string>> queries;
+    for(int k = 3; k <= 10; k++){
+        int added = 0;
+        for(int s = k; s + 1 < (int)c.sentences.size() && added < 4; s += 89){
+            Position first = c.sentences[s];
+            if(c.sentences[s + 1] - first < k){
+                continue;
+            }
+            std::string text;
+            bool writable = true;
+            for(Position i = first; i < first + k; i++){
+                const Token &t = c.tokens[i];
+                writable = writable && c.index2string[t.lemma].find_first_of("\"]") == std::string::npos;
+                text += (i - first) % 2 == 0 ? clause({literal(c, "pos", t.pos)}) : clause({literal(c, "lemma", t.lemma)});
+            }
+            if(writable){
+                queries.push_back({k, text});
+                added++;
+            }
+        }
+    }
+    return queries;
+}
+
+//Phrases of 2, 3 and 8 words copied from sentences
+std::vector<std::pair<int, std::string>> phrases(const Corpus &c){
+    std::vector<std::pair<int, std::string>> queries;
+    for(int k: {2, 3, 8}){
+        int added = 0;
+        for(int s = k; s + 1 < (int)c.sentences.size() && added < 8; s += 61){
+            Position first = c.sentences[s];
+            if(c.sentences[s + 1] - first < k){
+                continue;
+            }
+            std::string text;
+            bool writable = true;
+            for(Position i = first; i < first + k; i++){
+                writable = writable && c.index2string[c.tokens[i].word].find_first_of("\"]") == std::string::npos;
+                text += clause({literal(c, "word", c.tokens[i].word)});
+            }
+            if(writable){
+                queries.push_back({k, text});
+                added++;
+            }
+        }
+    }
+    return queries;
+}
+
+//Intersects posting lists one pair at a time from the smallest, the way match_set does for few literals
+ExplicitSet fold_intersection(const std::vector<IndexSet> &sets){
+    ExplicitSet folded = intersection(sets[0], sets[1]);
+    for(int i = 2; i < (int)sets.size(); i++){
+        folded = intersection(sets[i], folded);
+    }
+    //Positions before the corpus can not start a match, kway_intersection leaves them out
+    folded.elems.erase(folded.elems.begin(), std::lower_bound(folded.elems.begin(), folded.elems.end(), 0));
+    return folded;
+}
+
+//Splits a corpus file into about count parts at sentence boundaries, each part starts with the header
+//line so it can be loaded on its own
+std::vector<std::string> split_corpus(const std::string &filename, int count){
+    std::ifstream f(filename);
+    std::vector<std::string> lines;
+    for(std::string l; std::getline(f, l);){
+        lines.push_back(l);
+    }
+    size_t header = 0;
+    while(header < lines.size() && !lines[header].empty() && lines[header][0] == '#'){
+        header++;
+    }
+    std::vector<std::string> parts;
+    std::string part;
+    for(size_t i = header + 1; i < lines.size(); i++){
+        part += lines[i] + '\n';
+        bool full = (i - header) * count >= lines.size() * (parts.size() + 1);
+        if(lines[i].empty() && full && (int)parts.size() + 1 < count){
+            parts.push_back(lines[header] + '\n' + part);
+            part.clear();
+        }
+    }
+    parts.push_back(lines[header] + '\n' + part);
+    return parts;
+}
+
+int main(int argc, char *argv[]){
+    std::string filename = "bnc-05M.csv";
+    std::string json = "bench_results.jsonl";
+    int runs = 5;
+    for(int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        if(arg == "--runs" && i + 1 < argc){
+            runs = std::stoi(argv[++i]);
+        } else if(arg == "--json" && i + 1 < argc){
+            json = argv[++i];
+        } else{
+            filename = arg;
+        }
+    }
+    Corpus c;
+    double load_ms = time_ms([&]{ c = load_corpus(filename); });
+    record("load_corpus", "", load_ms, c.tokens.size());
+    if(c.tokens.empty()){
+        return 1;
+    }
+    long n = c.tokens.size();
+    std::cout << "tokens: " << n << " keys: " << c.index2string.size()
+              << " threads: " << build_threads(n, c.index2string.size()) << std::endl;
+
+    //Index building, the old stable sort is kept as a reference
+    std::vector<std::pair<std::string, uint32_t Token::*>> attributes = {
+        {"word", &Token::word}, {"lemma", &Token::lemma}, {"pos", &Token::pos}, {"c5", &Token::c5}};
+    bool same = true;
+    for(int r = 0; r < runs; r++){
+        for(auto &[name, attribute]: attributes){
+            Index sorted, counted;
+            record("build_index_stable_sort", name, time_ms([&]{ sorted = build_index_sort(c.tokens, attribute); }), n);
+            record("build_index", name, time_ms([&]{ counted = build_index(c.tokens, attribute); }), n);
+            same = same && sorted == counted;
+        }
+        record("build_indices", "", time_ms([&]{ build_indices(c); }), n);
+    }
+
+    //Queries, every stage is timed separately
+    std::vector<std::pair<std::string, std::string>> queries = workload(c);
+    for(int r = 0; r < runs; r++){
+        for(auto &[query_class, text]: queries){
+            Query q;
+            MatchSet set;
+            std::vector<Match> matches;
+            record("parse_query", query_class, time_ms([&]{ q = parse_query(text, c); }), 1);
+            record("match_set", query_class, time_ms([&]{ set = match_set(c, q); }), 1);
+            int size = q.size();
+            double ms = time_ms([&]{
+                matches = std::visit([&c, size](auto &&s){ return match2(c, s, size); }, set.set);
+            });
+            record("match2_convert", query_class, ms, matches.size());
+            record("match2", query_class, time_ms([&]{ matches = match2(c, q); }), matches.size());
+        }
+    }
+
+    //Posting list intersection against the token scan, plan_query picks one of the two
+    for(int r = 0; r < runs; r++){
+        for(auto &[query_class, text]: queries){
+            Query q = parse_query(text, c);
+            QueryPlan by_index = index_plan(c, q);
+            QueryPlan by_scan = scan_plan(c, q);
+            long indexed = 0, scanned = 0;
+            double ms = time_ms([&]{ for_each_position(by_index, [&indexed](Position){ indexed++; }); });
+            record("execute_index", query_class, ms, indexed);
+            ms = time_ms([&]{ for_each_position(by_scan, [&scanned](Position){ scanned++; }); });
+            record("execute_scan", query_class, ms, scanned);
+            same = same && indexed == scanned;
+        }
+    }
+
+    //Sampled estimates on a small budget against the exact count, the interval should hold it about as often as its confidence
+    long estimates = 0, covered = 0;
+    for(int r = 0; r < runs; r++){
+        for(auto &[query_class, text]: queries){
+            Query q = parse_query(text, c);
+            long exact = count_matches(c, plan_query(c, q), q.size());
+            EstimateOptions options;
+            options.budget_ms = 2;
+            options.seed = r + 1;
+            Estimate e;
+            double ms = time_ms([&]{ e = estimate_matches(c, q, options); });
+            record("estimate", query_class, ms, e.sampled_tokens);
+            estimates++;
+            covered += e.low <= exact && exact <= e.high;
+        }
+    }
+
+    //Frequency lists of the word forms of the hits, against building the matches and counting them in a hash table
+    for(int r = 0; r < runs; r++){
+        for(auto &[query_class, text]: queries){
+            Query q = parse_query(text, c);
+            GroupOptions options;
+            options.attribute = "word";
+            Grouping grouping;
+            double ms = time_ms([&]{ grouping = group_matches(c, q, options); });
+            record("group_matches", query_class, ms, grouping.hits);
+            std::vector<Group> hashed;
+            ms = time_ms([&]{
+                std::unordered_map<uint32_t, long> counts;
+                for(const Match &m: match2(c, q)){
+                    counts[c.tokens[c.sentences[m.sentence] + m.pos].word]++;
+                }
+                for(auto &[value, count]: counts){
+                    hashed.push_back(Group{value, count});
+                }
+                size_t top = std::min<size_t>(options.top, hashed.size());
+                std::partial_sort(hashed.begin(), hashed.begin() + top, hashed.end(), [](const Group &a, const Group &b){
+                    return a.count != b.count ? a.count > b.count : a.value < b.value;
+                });
+                hashed.resize(top);
+            });
+            record("group_hash", query_class, ms, grouping.hits);
+            same = same && std::equal(hashed.begin(), hashed.end(), grouping.top.begin(), grouping.top.end(), [](const Group &a, const Group &b){
+                return a.value == b.value && a.count == b.count;
+            });
+        }
+    }
+
+    //Frequent lemmas with the part of speech they mostly have, alone and followed by another clause, from
+    //their posting lists and then from materialized views of the pairs
+    std::vector<std::pair<std::string, Query>> paired;
+    std::vector<Clause> pairs;
+    std::vector<uint32_t> frequent_lemmas = by_frequency(c, &Token::lemma);
+    std::vector<uint32_t> frequent_pos = by_frequency(c, &Token::pos);
+    for(size_t i = 0; i < std::min<size_t>(frequent_lemmas.size(), 4); i++){
+        std::map<uint32_t, long> pos_counts;
+        for(Position t: index_lookup(c, "lemma", frequent_lemmas[i]).elems){
+            pos_counts[c.tokens[t].pos]++;
+        }
+        uint32_t pos = std::max_element(pos_counts.begin(), pos_counts.end(), [](const auto &a, const auto &b){ return a.second < b.second; })->first;
+        std::string pair = clause({literal(c, "pos", pos), literal(c, "lemma", frequent_lemmas[i])});
+        pairs.push_back(parse_query(pair, c)[0]);
+        paired.push_back({"pair", parse_query(pair, c)});
+        paired.push_back({"pair_sequence", parse_query(pair + clause({literal(c, "pos", frequent_pos[0])}), c)});
+    }
+    std::vector<std::vector<Match>> unviewed(paired.size());
+    for(int r = 0; r < runs; r++){
+        for(size_t i = 0; i < paired.size(); i++){
+            auto &[query_class, q] = paired[i];
+            double ms = time_ms([&]{ unviewed[i] = match2(c, q); });
+            record("match2_posting_lists", query_class, ms, unviewed[i].size());
+        }
+    }
+    double view_ms = time_ms([&]{
+        for(const Clause &pair: pairs){
+            c.views.push_back(build_view(c, pair));
+        }
+    });
+    record("build_views", "", view_ms, pairs.size());
+    for(int r = 0; r < runs; r++){
+        for(size_t i = 0; i < paired.size(); i++){
+            auto &[query_class, q] = paired[i];
+            std::vector<Match> viewed;
+            double ms = time_ms([&]{ viewed = match2(c, q); });
+            record("match2_view", query_class, ms, viewed.size());
+            same = same && std::equal(viewed.begin(), viewed.end(), unviewed[i].begin(), unviewed[i].end(), [](const Match &a, const Match &b){
+                return a.sentence == b.sentence && a.pos == b.pos;
+            });
+        }
+    }
+    c.views.clear();
+
+    //Posting lists of a frequent, a medium and a rare value copied from the plain index, decoded from the
+    //compressed lists and bitmaps and found by a scan, with the bytes of every representation
+    for(std::string attribute: {"pos", "c5", "lemma"}){
+        std::vector<uint32_t> values = by_frequency(c, attribute_member(attribute));
+        std::vector<uint32_t> probes = {values[0], values[values.size() / 10], values[values.size() - 1]};
+        std::map<IndexKind, long> sizes = index_sizes(c, attribute);
+        std::cout << attribute << " index MB:";
+        for(auto &[kind, bytes]: sizes){
+            std::cout << " " << index_kind_name(kind) << " " << bytes / 1048576.0;
+        }
+        std::cout << std::endl;
+        for(auto &[kind, bytes]: sizes){
+            PackedIndex packed = kind == IndexKind::plain ? PackedIndex() : pack_index(c, attribute, kind);
+            for(int r = 0; r < runs; r++){
+                for(uint32_t value: probes){
+                    std::vector<Position> positions;
+                    double ms = time_ms([&]{
+                        if(kind == IndexKind::plain){
+                            std::span<const Position> found = index_lookup(c, attribute, value).elems;
+                            positions.assign(found.begin(), found.end());
+                        } else{
+                            positions = decode_postings(c, attribute, packed, value);
+                        }
+                    });
+                    record(std::string("lookup_") + index_kind_name(kind), attribute, ms, positions.size());
+                    std::span<const Position> plain = index_lookup(c, attribute, value).elems;
+                    same = same && std::equal(positions.begin(), positions.end(), plain.begin(), plain.end());
+                }
+            }
+        }
+    }
+
+    //Sentences containing two or three lemmas anywhere, from the sentence index
+    std::vector<uint32_t> lemmas = by_frequency(c, &Token::lemma);
+    if(lemmas.size() >= 4){
+        uint32_t frequent = lemmas[0], second = lemmas[1], medium = lemmas[lemmas.size() / 100], rare = lemmas[lemmas.size() / 2];
+        std::vector<std::string> cooccurrence = {
+            clause({literal(c, "lemma", frequent)}) + clause({literal(c, "lemma", second)}),
+            clause({literal(c, "lemma", frequent)}) + clause({literal(c, "lemma", medium)}),
+            clause({literal(c, "lemma", medium)}) + clause({literal(c, "lemma", rare)}) + clause({literal(c, "lemma", second)}),
+        };
+        for(int r = 0; r < runs; r++){
+            for(const std::string &text: cooccurrence){
+                Query q = parse_query(text, c);
+                std::vector<Position> sentences;
+                double ms = time_ms([&]{ sentences = match_sentences(c, q); });
+                record("match_sentences", "cooccurrence", ms, sentences.size());
+            }
+        }
+    }
+
+    //k-way intersection against the pairwise fold, on the posting lists alone
+    std::vector<std::pair<int, std::string>> kway_queries = conjunctions(c);
+    for(int r = 0; r < runs; r++){
+        for(auto &[k, text]: kway_queries){
+            QueryPlan plan = index_plan(c, parse_query(text, c));
+            ExplicitSet folded, kway;
+            std::string query_class = "k=" + std::to_string(k);
+            record("intersect_pairwise", query_class, time_ms([&]{ folded = fold_intersection(plan.include); }), 1);
+            record("intersect_kway", query_class, time_ms([&]{ kway = kway_intersection(plan.include); }), 1);
+            same = same && folded.elems == kway.elems;
+        }
+    }
+
+    //Append-only ingestion: the corpus is appended as four segments, which are merged one pair at a time and then
+    //compacted, every workload query must find the same matches as on the monolithic corpus in between
+    std::vector<std::string> parts = split_corpus(filename, 4);
+    for(int r = 0; r < runs; r++){
+        SegmentedCorpus segmented;
+        auto check = [&](const std::string &stage){
+            same = same && num_tokens(segmented.segments) == n && num_sentences(segmented.segments) == (Position)c.sentences.size() - 1;
+            for(auto &[query_class, text]: queries){
+                std::vector<Match> expected = match2(c, parse_query(text, c));
+                Query q = parse_query(text, segmented);
+                std::vector<Match> found;
+                double ms = time_ms([&]{ found = match2(segmented, q); });
+                record(stage, query_class, ms, found.size());
+                same = same && std::equal(found.begin(), found.end(), expected.begin(), expected.end(), [](const Match &a, const Match &b){
+                    return a.sentence == b.sentence && a.pos == b.pos && a.len == b.len;});
+            }
+        };
+        for(const std::string &part: parts){
+            std::istringstream f(part);
+            Position before = num_tokens(segmented.segments);
+            double ms = time_ms([&]{ append_segment(segmented, f); });
+            record("append_segment", "", ms, num_tokens(segmented.segments) - before);
+        }
+        check("match2_segments");
+        double ms = time_ms([&]{ merge_step(segmented); });
+        record("merge_step", "", ms, n);
+        check("match2_merged");
+        record("compact", "", time_ms([&]{ compact(segmented); }), n);
+        same = same && segmented.segments.size() == 1;
+        check("match2_compacted");
+    }
+
+    //Phrases through the posting lists and through the suffix array
+    std::vector<std::pair<int, std::string>> phrase_queries = phrases(c);
+    Index suffixes;
+    for(int r = 0; r < runs; r++){
+        record("build_suffix_array", "", time_ms([&]{ build_suffix_array(c); }), n);
+        std::swap(suffixes, c.word_suffixes);
+        for(auto &[k, text]: phrase_queries){
+            Query q = parse_query(text, c);
+            std::vector<Match> by_index, by_suffix;
+            std::string query_class = "words=" + std::to_string(k);
+            double ms = time_ms([&]{ by_index = match2(c, q); });
+            record("phrase_index", query_class, ms, by_index.size());
+            std::swap(suffixes, c.word_suffixes);
+            ms = time_ms([&]{ by_suffix = match2(c, q); });
+            record("phrase_suffix_array", query_class, ms, by_suffix.size());
+            std::swap(suffixes, c.word_suffixes);
+            same = same && std::equal(by_suffix.begin(), by_suffix.end(), by_index.begin(), by_index.end(), [](const Match &a, const Match &b){
+                return a.sentence == b.sentence && a.pos == b.pos && a.len == b.len;});
+        }
+        c.word_suffixes.clear();
+    }
+
+    //Searches for random positions with std::upper_bound and in the Eytzinger layout, over the sentence
+    //starts, the longest posting list of a word and sorted random positions of growing size
+    std::vector<std::pair<std::string, Index>> searched = {{"sentences", c.sentences}};
+    std::vector<uint32_t> words = by_frequency(c, &Token::word);
+    if(!words.empty()){
+        IndexSet longest = index_lookup(c, "word", words[0]);
+        searched.push_back({"postings", Index(longest.elems.begin(), longest.elems.end())});
+    }
+    std::mt19937 search_random(1);
+    for(int bits: {10, 16, 22}){
+        Index sorted(1 << bits);
+        for(Position &p: sorted){
+            p = search_random() % n;
+        }
+        std::sort(sorted.begin(), sorted.end());
+        searched.push_back({"n=2^" + std::to_string(bits), sorted});
+    }
+    std::vector<Position> keys(1 << 20);
+    for(Position &k: keys){
+        k = search_random() % n;
+    }
+    for(auto &[search_class, sorted]: searched){
+        EytzingerTree tree = eytzinger_layout(sorted);
+        for(int r = 0; r < runs; r++){
+            long by_bound = 0, by_tree = 0;
+            double ms = time_ms([&]{
+                for(Position k: keys){
+                    by_bound += std::upper_bound(sorted.begin(), sorted.end(), k) - sorted.begin();
+                }
+            });
+            record("search_upper_bound", search_class, ms, keys.size());
+            ms = time_ms([&]{
+                for(Position k: keys){
+                    by_tree += eytzinger_upper_bound(tree, k);
+                }
+            });
+            record("search_eytzinger", search_class, ms, keys.size());
+            same = same && by_bound == by_tree;
+        }
+    }
+
+    //Random token gathers and index lookups (a binary search of the index through the tokens), first on
+    //small pages and then after the arrays are moved to huge pages. Runs last as it changes the pages.
+    std::mt19937 random(1);
+    std::vector<Position> probes(1 << 20);
+    for(Position &p: probes){
+        p = random() % n;
+    }
+    std::vector<uint32_t> lookups;
+    for(int i = 0; i < (1 << 14); i++){
+        lookups.push_back(c.tokens[probes[i]].word);
+    }
+    //Expected results from the tokens alone: the lemma sum of the probes and how often each looked up word occurs
+    long expected_sum = 0, expected_found = 0;
+    std::vector<long> frequency(c.index2string.size(), 0);
+    for(const Token &t: c.tokens){
+        frequency[t.word]++;
+    }
+    for(Position p: probes){
+        expected_sum += c.tokens[p].lemma;
+    }
+    for(uint32_t value: lookups){
+        expected_found += frequency[value];
+    }
+    for(const std::string pages: {"small", "huge"}){
+        if(pages == "huge"){
+            PlacementReport report = place_corpus(c, PlacementOptions{true, false});
+            std::cout << report.huge_bytes / (1 << 20) << " of " << report.bytes / (1 << 20) << " MB in huge pages"
+                      << (report.error.empty() ? "" : ", " + report.error) << std::endl;
+        }
+        long gather_misses = 0, lookup_misses = 0;
+        bool counted = true;
+        for(int r = 0; r < runs; r++){
+            long sum = 0;
+            TlbCounter tlb;
+            double ms = time_ms([&]{
+                for(Position p: probes){
+                    sum += c.tokens[p].lemma;
+                }
+            });
+            long gathered = tlb.misses();
+            record("gather_tokens", pages, ms, probes.size());
+            long found = 0;
+            ms = time_ms([&]{
+                for(uint32_t value: lookups){
+                    found += index_lookup(c.word_index, c.tokens, &Token::word, value).elems.size();
+                }
+            });
+            long looked_up = tlb.misses();
+            record("index_lookup", pages, ms, lookups.size());
+            counted = counted && gathered >= 0;
+            gather_misses += gathered;
+            lookup_misses += looked_up - gathered;
+            //Moving the arrays to other pages must not change what the gathers and lookups read
+            same = same && sum == expected_sum && found == expected_found;
+        }
+        if(counted){
+            std::printf("dTLB misses per lookup on %s pages: gather %.3f, index_lookup %.2f\n", pages.c_str(),
+                        (double)gather_misses / runs / probes.size(), (double)lookup_misses / runs / lookups.size());
+        }
+    }
+
+    std::ofstream out(json);
+    std::printf("%-24s %-12s %6s %10s %10s %14s\n", "stage", "class", "runs", "p50 ms", "p99 ms", "items/s");
+    for(Timings &t: results){
+        double total = 0;
+        for(double ms: t.ms){
+            total += ms;
+        }
+        double p50 = percentile(t.ms, 0.5);
+        double p99 = percentile(t.ms, 0.99);
+        double throughput = total > 0 ? t.items / (total / 1000) : 0;
+        std::printf("%-24s %-12s %6zu %10.3f %10.3f %14.0f\n", t.stage.c_str(), t.query_class.c_str(), t.ms.size(), p50, p99, throughput);
+        out << "{\"stage\":\"" << t.stage << "\",\"class\":\"" << t.query_class << "\",\"runs\":" << t.ms.size()
+            << ",\"p50_ms\":" << p50 << ",\"p99_ms\":" << p99 << ",\"items_per_s\":" << throughput
+            << ",\"tokens\":" << n << "}\n";
+    }
+    std::cout << "estimate intervals holding the exact count: " << covered << " of " << estimates << std::endl;
+    std::cout << "indices and intersections " << (same ? "identical" : "DIFFER") << ", results written to " << json << std::endl;
+    return same ? 0 : 1;
+}
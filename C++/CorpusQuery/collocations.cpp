@@ -0,0 +1,161 @@
+#include <unordered_map>
+#include <thread>
+#include <exception>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+#include "collocations.h"
+//Hits per thread below which no more threads are started
+const size_t collocation_min_hits = 4096;
+
+//Counts the values of the attribute in the windows around a range of hits
+void count_windows(const Corpus &corpus, const std::vector<Match> &hits, size_t first, size_t last, const CollocationOptions &options,
+                   uint32_t Token::* attribute, std::unordered_map<uint32_t, long> &counts, long &window_tokens){
+    Position n = corpus.tokens.size();
+    for(size_t h = first; h < last; h++){
+        const Match &m = hits[h];
+        Position sentence_first = corpus.sentences[m.sentence];
+        Position start = sentence_first + m.pos;
+        Position end = start + m.len;
+        Position lo = options.within_sentence ? sentence_first : 0;
+        Position hi = options.within_sentence ? corpus.sentences[m.sentence + 1] : n;
+        lo = std::max(lo, start - options.left);
+        hi = std::min(hi, end + options.right);
+        for(Position i = lo; i < start; i++){
+            counts[corpus.tokens[i].*attribute]++;
+        }
+        for(Position i = end; i < hi; i++){
+            counts[corpus.tokens[i].*attribute]++;
+        }
+        window_tokens += (start - lo) + (hi - end);
+        //Counted tokens are the work, so a cancel or timeout is noticed after a few thousand hits
+        poll_budget(1 + (start - lo) + (hi - end));
+    }
+}
+
+//G2 term of one cell of the contingency table, empty cells add nothing
+double log_likelihood_term(double observed, double expected){
+    return observed > 0 && expected > 0 ? observed * std::log(observed / expected) : 0;
+}
+
+//Finds the words that occur unusually often near the hits of a node query. Windows around the hits
+//are counted in parallel, every thread into its own hash table, and the tables are added up after.
+//Association is measured against the corpus frequency of each collocate from the token index.
+std::vector<Collocate> collocations(const Corpus &corpus, const Query &node, const CollocationOptions &options){
+    uint32_t Token::* attribute = attribute_member(options.attribute);
+    //A negative size would move the window into the hit and count its own tokens
+    if(options.left < 0 || options.right < 0){
+        throw std::invalid_argument("Window sizes can not be negative");
+    }
+    std::vector<Match> hits = match2(corpus, node);
+    int threads = options.threads > 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    threads = std::clamp<int>(hits.size() / collocation_min_hits, 1, threads);
+    std::vector<std::unordered_map<uint32_t, long>> counts(threads);
+    std::vector<long> window_tokens(threads, 0);
+    std::vector<std::exception_ptr> errors(threads);
+    QueryBudget *budget = active_budget;
+    std::vector<std::thread> workers;
+    size_t chunk = (hits.size() + threads - 1) / threads;
+    auto work = [&](int t){
+        WorkerBudgetScope scope(budget);
+        try{
+            size_t first = std::min(hits.size(), t * chunk);
+            size_t last = std::min(hits.size(), first + chunk);
+            count_windows(corpus, hits, first, last, options, attribute, counts[t], window_tokens[t]);
+        } catch(...){
+            errors[t] = std::current_exception();
+        }
+    };
+    for(int t = 1; t < threads; t++){
+        workers.emplace_back(work, t);
+    }
+    work(0);
+    for(std::thread &w: workers){
+        w.join();
+    }
+    for(std::exception_ptr &e: errors){
+        if(e){
+            std::rethrow_exception(e);
+        }
+    }
+    for(int t = 1; t < threads; t++){
+        for(auto &[value, count]: counts[t]){
+            counts[0][value] += count;
+        }
+        window_tokens[0] += window_tokens[t];
+    }
+
+    //Contingency table per collocate: windows against the rest of the corpus, collocate against other values
+    double N = corpus.tokens.size();
+    double W = window_tokens[0];
+    std::vector<Collocate> collocates;
+    for(auto &[value, observed]: counts[0]){
+        if(observed < options.min_count){
+            continue;
+        }
+        Collocate c;
+        c.value = value;
+        c.observed = observed;
+        c.frequency = posting_size(corpus, options.attribute, value);
+        c.expected = W * c.frequency / N;
+        double O11 = observed;
+        double O12 = std::max(0.0, W - O11);
+        double O21 = std::max(0.0, c.frequency - O11);
+        double O22 = std::max(0.0, N - W - O21);
+        double E11 = (O11 + O12) * (O11 + O21) / N;
+        double E12 = (O11 + O12) * (O12 + O22) / N;
+        double E21 = (O21 + O22) * (O11 + O21) / N;
+        double E22 = (O21 + O22) * (O12 + O22) / N;
+        c.mi = std::log2(O11 / c.expected);
+        c.t_score = (O11 - c.expected) / std::sqrt(O11);
+        c.log_likelihood = 2 * (log_likelihood_term(O11, E11) + log_likelihood_term(O12, E12)
+                              + log_likelihood_term(O21, E21) + log_likelihood_term(O22, E22));
+        //Signed, so collocates seen less often than expected rank last
+        if(O11 < E11){
+            c.log_likelihood = -c.log_likelihood;
+        }
+        collocates.push_back(c);
+    }
+    size_t top = std::min<size_t>(std::max(options.top, 0), collocates.size());
+    std::partial_sort(collocates.begin(), collocates.begin() + top, collocates.end(), [&options](const Collocate &a, const Collocate &b){
+        double x = association(a, options.measure);
+        double y = association(b, options.measure);
+        return x != y ? x > y : a.value < b.value;
+    });
+    collocates.resize(top);
+    return collocates;
+}
+
+double association(const Collocate &c, Association measure){
+    if(measure == Association::mi){
+        return c.mi;
+    } else if(measure == Association::t_score){
+        return c.t_score;
+    }
+    return c.log_likelihood;
+}
+
+//Gets an association measure from its name
+Association parse_measure(const std::string &name){
+    if(name == "mi"){
+        return Association::mi;
+    } else if(name == "t" || name == "tscore"){
+        return Association::t_score;
+    } else if(name == "ll" || name == "g2"){
+        return Association::log_likelihood;
+    }
+    throw std::invalid_argument("Association measure " + name + " does not exist");
+}
+
+//Prints collocates as a table
+void print_collocations(std::ostream &out, const Corpus &corpus, const std::vector<Collocate> &collocates){
+    char line[256];
+    std::snprintf(line, sizeof(line), "%-20s %10s %10s %10s %8s %8s %10s\n", "collocate", "observed", "frequency", "expected", "mi", "t", "ll");
+    out << line;
+    for(const Collocate &c: collocates){
+        std::snprintf(line, sizeof(line), "%-20s %10ld %10ld %10.2f %8.2f %8.2f %10.2f\n", corpus.index2string[c.value].c_str(),
+                      c.observed, c.frequency, c.expected, c.mi, c.t_score, c.log_likelihood);
+        out << line;
+    }
+}
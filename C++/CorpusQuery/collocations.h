@@ -0,0 +1,38 @@
+#ifndef COLLOCATIONS_H
+#define COLLOCATIONS_H
+#include "query_corpora.h"
+#include <ostream>
+enum class Association { mi, t_score, log_likelihood };
+struct CollocationOptions
+{
+    //Attribute the collocates are counted by
+    std::string attribute = "lemma";
+    //Tokens counted before the first and after the last token of each hit
+    int left = 5;
+    int right = 5;
+    //Windows stop at sentence boundaries
+    bool within_sentence = true;
+    Association measure = Association::log_likelihood;
+    //Number of collocates returned and the number of co-occurrences a collocate needs
+    int top = 20;
+    long min_count = 3;
+    //0 uses one thread per core
+    int threads = 0;
+};
+struct Collocate
+{
+    uint32_t value;
+    //Co-occurrences with the node, corpus frequency and co-occurrences expected by chance
+    long observed;
+    long frequency;
+    double expected;
+    double mi;
+    double t_score;
+    //Negative when the collocate occurs less often than expected
+    double log_likelihood;
+};
+std::vector<Collocate> collocations(const Corpus &corpus, const Query &node, const CollocationOptions &options);
+double association(const Collocate &c, Association measure);
+Association parse_measure(const std::string &name);
+void print_collocations(std::ostream &out, const Corpus &corpus, const std::vector<Collocate> &collocates);
+#endif
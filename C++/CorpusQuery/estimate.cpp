@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include "estimate.h"
+
+//Estimates the number of matches of a query by evaluating its plan on shards of sentences in random order
+//until the time budget is used up. The count is the match rate per token of the sampled shards times the
+//corpus size (a ratio estimator, shards differ in length), its interval comes from the spread of the shards
+//around that rate. A query of a single literal is counted exactly from the length of its posting list.
+Estimate estimate_matches(const Corpus &corpus, const Query &query, const EstimateOptions &options){
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed_ms = [&start](){
+        std::chrono::duration<double, std::milli> d = std::chrono::steady_clock::now() - start;
+        return d.count();
+    };
+    Estimate e{};
+    std::mt19937_64 random(options.seed ? options.seed : std::random_device()());
+    QueryPlan plan = plan_query(corpus, query);
+    int size = query.size();
+    Position num_sentences = corpus.sentences.size() - 1;
+    Position per_shard = std::max(1, options.shard_sentences);
+    e.total_shards = (num_sentences + per_shard - 1) / per_shard;
+    double T = corpus.tokens.size();
+    if(size == 1 && !plan.scan && plan.include.size() == 1 && plan.exclude.empty()){
+        std::span<const Position> hits = plan.include[0].elems;
+        e.count = e.low = e.high = e.hits = hits.size();
+        e.exact = true;
+        e.sampled_tokens = T;
+        std::vector<Position> picked;
+        for(int i = 0; i < options.examples && !hits.empty(); i++){
+            picked.push_back(hits[std::uniform_int_distribution<size_t>(0, hits.size() - 1)(random)]);
+        }
+        std::sort(picked.begin(), picked.end());
+        SentenceCursor cursor{corpus};
+        Match m;
+        for(Position t: picked){
+            if(cursor.to_match(t, 1, m)){
+                e.examples.push_back(m);
+            }
+        }
+        e.ms = elapsed_ms();
+        return e;
+    }
+    std::vector<Position> order(e.total_shards);
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), random);
+    //Sums over the evaluated shards of matches y and tokens t, for the rate and the spread around it
+    double sum_y = 0, sum_t = 0, sum_yy = 0, sum_tt = 0, sum_yt = 0;
+    QueryPlan shard = plan;
+    for(Position s: order){
+        Position first = s * per_shard;
+        Position last = std::min(first + per_shard, num_sentences);
+        shard.range.first = std::max(plan.range.first, corpus.sentences[first]);
+        shard.range.last = std::min(plan.range.last, corpus.sentences[last] - 1);
+        long y = 0;
+        SentenceCursor cursor{corpus, first};
+        Match m;
+        for_each_position(shard, [&](Position t){
+            if(cursor.to_match(t, size, m)){
+                y++;
+                if((int)e.examples.size() < options.examples){
+                    e.examples.push_back(m);
+                }
+            }
+        });
+        double t = corpus.sentences[last] - corpus.sentences[first];
+        sum_y += y;
+        sum_t += t;
+        sum_yy += (double)y * y;
+        sum_tt += t * t;
+        sum_yt += y * t;
+        e.shards++;
+        if(elapsed_ms() >= options.budget_ms){
+            break;
+        }
+    }
+    e.hits = sum_y;
+    e.sampled_tokens = sum_t;
+    std::sort(e.examples.begin(), e.examples.end(), [](const Match &a, const Match &b){
+        return a.sentence != b.sentence ? a.sentence < b.sentence : a.pos < b.pos;
+    });
+    e.exact = e.shards == e.total_shards;
+    if(e.exact || sum_t == 0){
+        e.count = e.low = e.high = sum_y;
+        e.ms = elapsed_ms();
+        return e;
+    }
+    double z = normal_quantile(options.confidence);
+    double n = e.shards;
+    double rate = sum_y / sum_t;
+    e.count = rate * T;
+    if(sum_y == 0){
+        //No match in the sample, the upper end of the Wilson interval for no successes in sum_t tokens
+        e.low = 0;
+        e.high = T * z * z / (sum_t + z * z);
+    } else{
+        //Variance of the ratio estimator with the finite population correction, the residuals of the
+        //shards around the rate are expanded from the sums
+        double residuals = std::max(0.0, sum_yy - 2 * rate * sum_yt + rate * rate * sum_tt);
+        //A single shard has no spread, its count is taken to be Poisson
+        double spread = n > 1 ? residuals / (n - 1) : rate * sum_t;
+        double mean_t = sum_t / n;
+        double error = T * std::sqrt((1 - n / e.total_shards) * spread / (n * mean_t * mean_t));
+        e.low = std::max(sum_y, e.count - z * error);
+        e.high = e.count + z * error;
+    }
+    e.ms = elapsed_ms();
+    return e;
+}
+
+//z such that a standard normal variable is within -z and z with the given probability, by Newton's method on erf
+double normal_quantile(double confidence){
+    confidence = std::clamp(confidence, 0.5, 0.999999);
+    double z = 1;
+    for(int i = 0; i < 50; i++){
+        double f = std::erf(z / std::sqrt(2.0)) - confidence;
+        z -= f / (std::sqrt(2 / M_PI) * std::exp(-z * z / 2));
+    }
+    return z;
+}
+
+//Prints an estimate on one line
+void print_estimate(std::ostream &out, const Corpus &corpus, const Estimate &estimate, const EstimateOptions &options){
+    char line[256];
+    double share = corpus.tokens.empty() ? 0 : 100.0 * estimate.sampled_tokens / corpus.tokens.size();
+    if(estimate.exact){
+        std::snprintf(line, sizeof(line), "%.0f matches (exact) in %.1f ms\n", estimate.count, estimate.ms);
+    } else{
+        std::snprintf(line, sizeof(line), "About %.0f matches (%.0f%% interval %.0f-%.0f) from %ld of %ld shards (%.1f%% of tokens) in %.1f ms\n",
+                      estimate.count, 100 * options.confidence, estimate.low, estimate.high, estimate.shards, estimate.total_shards, share, estimate.ms);
+    }
+    out << line;
+}
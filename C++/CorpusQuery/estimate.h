@@ -0,0 +1,38 @@
+#ifndef ESTIMATE_H
+#define ESTIMATE_H
+#include "query_corpora.h"
+#include <ostream>
+struct EstimateOptions
+{
+    //Time the estimate may take, shards are evaluated until it is used up
+    double budget_ms = 50;
+    //Consecutive sentences evaluated together, a shard is the unit that is sampled
+    int shard_sentences = 64;
+    //Probability that the interval holds the exact count
+    double confidence = 0.95;
+    //Matches kept as examples
+    int examples = 10;
+    //0 draws a new sample every time
+    uint64_t seed = 0;
+};
+struct Estimate
+{
+    //Estimated number of matches and its confidence interval
+    double count;
+    double low;
+    double high;
+    //True if every shard was evaluated or the count came from a posting list, the count is then exact
+    bool exact;
+    //Matches and tokens in the evaluated shards
+    long hits;
+    long sampled_tokens;
+    long shards;
+    long total_shards;
+    double ms;
+    //Matches from the evaluated shards in corpus order
+    std::vector<Match> examples;
+};
+Estimate estimate_matches(const Corpus &corpus, const Query &query, const EstimateOptions &options);
+double normal_quantile(double confidence);
+void print_estimate(std::ostream &out, const Corpus &corpus, const Estimate &estimate, const EstimateOptions &options);
+#endif
@@ -0,0 +1,189 @@
+#include <cstring>
+#include <stdexcept>
+#include "export.h"
+//The buffer is written to the stream once it grows past this size
+const size_t export_flush_size = 1 << 20;
+
+MatchExporter::MatchExporter(const Corpus &corpus, std::ostream &out, ExportFormat format, const std::vector<std::string> &attributes)
+    : corpus(corpus), out(out), format(format), names(attributes), written(0){
+    for(const std::string &a: attributes){
+        this->attributes.push_back(attribute_member(a));
+    }
+    buffer.reserve(2 * export_flush_size);
+    write_header();
+}
+//Errors can not be thrown from here, export_matches flushes and reports them before
+MatchExporter::~MatchExporter(){
+    out.write(buffer.data(), buffer.size());
+}
+
+//Writes one match, start is the corpus position of its first token
+void MatchExporter::write(const Match &m){
+    Position start = corpus.sentences[m.sentence] + m.pos;
+    if(format == ExportFormat::jsonl){
+        write_jsonl(m, start);
+    } else if(format == ExportFormat::tsv){
+        write_tsv(m, start);
+    } else{
+        write_binary(m, start);
+    }
+    written++;
+    if(buffer.size() >= export_flush_size){
+        flush();
+    }
+}
+
+//Writes everything in the buffer to the stream, throws if the stream failed so no data is lost silently
+void MatchExporter::flush(){
+    out.write(buffer.data(), buffer.size());
+    buffer.clear();
+    if(!out){
+        throw std::invalid_argument("Unable to write the exported matches");
+    }
+}
+
+//Number of matches written so far
+long MatchExporter::count() const{
+    return written;
+}
+
+void MatchExporter::write_header(){
+    if(format == ExportFormat::tsv){
+        buffer += "sentence\tpos\tlen";
+        for(const std::string &name: names){
+            buffer += '\t';
+            buffer += name;
+        }
+        buffer += '\n';
+    } else if(format == ExportFormat::binary){
+        //Ids are only meaningful with the dictionary, so it is written once up front
+        buffer += sizeof(Position) == 4 ? "CQX1" : "CQX2";
+        append_u32(names.size());
+        for(const std::string &name: names){
+            append_string(name);
+        }
+        append_u32(corpus.index2string.size());
+        for(const std::string &s: corpus.index2string){
+            append_string(s);
+            if(buffer.size() >= export_flush_size){
+                flush();
+            }
+        }
+    }
+}
+
+void MatchExporter::write_jsonl(const Match &m, Position start){
+    buffer += "{\"sentence\":";
+    buffer += std::to_string(m.sentence);
+    buffer += ",\"pos\":";
+    buffer += std::to_string(m.pos);
+    buffer += ",\"len\":";
+    buffer += std::to_string(m.len);
+    for(int a = 0; a < (int)attributes.size(); a++){
+        buffer += ",\"";
+        buffer += names[a];
+        buffer += "\":[";
+        for(Position i = start; i < start + m.len; i++){
+            if(i > start){
+                buffer += ',';
+            }
+            append_json_string(buffer, corpus.index2string[corpus.tokens[i].*attributes[a]]);
+        }
+        buffer += ']';
+    }
+    buffer += "}\n";
+}
+
+void MatchExporter::write_tsv(const Match &m, Position start){
+    buffer += std::to_string(m.sentence);
+    buffer += '\t';
+    buffer += std::to_string(m.pos);
+    buffer += '\t';
+    buffer += std::to_string(m.len);
+    for(uint32_t Token::* attribute: attributes){
+        buffer += '\t';
+        for(Position i = start; i < start + m.len; i++){
+            if(i > start){
+                buffer += ' ';
+            }
+            buffer += corpus.index2string[corpus.tokens[i].*attribute];
+        }
+    }
+    buffer += '\n';
+}
+
+void MatchExporter::write_binary(const Match &m, Position start){
+    append_position(m.sentence);
+    append_u32(m.pos);
+    append_u32(m.len);
+    for(Position i = start; i < start + m.len; i++){
+        for(uint32_t Token::* attribute: attributes){
+            append_u32(corpus.tokens[i].*attribute);
+        }
+    }
+}
+
+void MatchExporter::append_u32(uint32_t x){
+    char bytes[sizeof(x)];
+    std::memcpy(bytes, &x, sizeof(x));
+    buffer.append(bytes, sizeof(x));
+}
+
+void MatchExporter::append_position(Position x){
+    char bytes[sizeof(x)];
+    std::memcpy(bytes, &x, sizeof(x));
+    buffer.append(bytes, sizeof(x));
+}
+
+void MatchExporter::append_string(const std::string &s){
+    append_u32(s.size());
+    buffer += s;
+}
+
+//Gets an export format from its name
+ExportFormat parse_format(const std::string &name){
+    if(name == "jsonl"){
+        return ExportFormat::jsonl;
+    } else if(name == "tsv"){
+        return ExportFormat::tsv;
+    } else if(name == "bin" || name == "binary"){
+        return ExportFormat::binary;
+    }
+    throw std::invalid_argument("Export format " + name + " does not exist");
+}
+
+//Runs a query and streams every match to the exporter without building a vector of matches, returns the number of matches
+long export_matches(const Corpus &corpus, const Query &query, MatchExporter &exporter){
+    return export_matches(corpus, plan_query(corpus, query), query.size(), exporter);
+}
+long export_matches(const Corpus &corpus, const QueryPlan &plan, int size, MatchExporter &exporter){
+    long before = exporter.count();
+    SentenceCursor cursor{corpus};
+    Match m;
+    for_each_position(plan, [&](Position t){
+        if(cursor.to_match(t, size, m)){
+            exporter.write(m);
+        }
+    });
+    exporter.flush();
+    return exporter.count() - before;
+}
+
+//Appends a string as a quoted JSON string
+void append_json_string(std::string &buffer, const std::string &s){
+    buffer += '"';
+    for(unsigned char c: s){
+        if(c == '"' || c == '\\'){
+            buffer += '\\';
+            buffer += c;
+        } else if(c < 0x20){
+            const char *hex = "0123456789abcdef";
+            buffer += "\\u00";
+            buffer += hex[c >> 4];
+            buffer += hex[c & 0xF];
+        } else{
+            buffer += c;
+        }
+    }
+    buffer += '"';
+}
@@ -0,0 +1,41 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+#include "query_corpora.h"
+#include <ostream>
+//jsonl: one object per match, {"sentence":1,"pos":2,"len":1,"word":["the"],...}
+//tsv: a header line then sentence, pos, len and one column per attribute, tokens separated by spaces
+//binary: "CQX1", attribute count, attribute names, dictionary size, dictionary strings, then for every
+//match sentence, pos, len and len * attribute count ids. Counts and ids are 32 bit in host byte order
+//and strings are a 32 bit length followed by the bytes. Builds with 64 bit positions write "CQX2" and
+//a 64 bit sentence number, everything else is unchanged.
+enum class ExportFormat { jsonl, tsv, binary };
+//Writes matches with selected token attributes as data. Output is collected in a buffer that is
+//written in large blocks, so millions of matches can be streamed without keeping them in memory.
+class MatchExporter
+{
+const Corpus &corpus;
+std::ostream &out;
+ExportFormat format;
+std::vector<std::string> names;
+std::vector<uint32_t Token::*> attributes;
+std::string buffer;
+long written;
+void write_header();
+void write_jsonl(const Match &m, Position start);
+void write_tsv(const Match &m, Position start);
+void write_binary(const Match &m, Position start);
+void append_u32(uint32_t x);
+void append_position(Position x);
+void append_string(const std::string &s);
+public:
+    MatchExporter(const Corpus &corpus, std::ostream &out, ExportFormat format, const std::vector<std::string> &attributes);
+    ~MatchExporter();
+    void write(const Match &m);
+    void flush();
+    long count() const;
+};
+ExportFormat parse_format(const std::string &name);
+long export_matches(const Corpus &corpus, const Query &query, MatchExporter &exporter);
+long export_matches(const Corpus &corpus, const QueryPlan &plan, int size, MatchExporter &exporter);
+void append_json_string(std::string &buffer, const std::string &s);
+#endif
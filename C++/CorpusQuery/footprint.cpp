@@ -0,0 +1,284 @@
+#include <cstdio>
+#include <sstream>
+#include <stdexcept>
+#include "footprint.h"
+//Parent, left and right pointers and the color of a red-black tree node, before its value
+const long map_node_bytes = 4 * sizeof(void *);
+//Strings up to this length are stored inside the string object
+const size_t short_string_capacity = 15;
+
+template <typename T>
+long vector_bytes(const std::vector<T> &v){
+    return v.capacity() * sizeof(T);
+}
+long string_bytes(const std::string &s){
+    return s.capacity() > short_string_capacity ? s.capacity() + 1 : 0;
+}
+long packed_bytes(const PackedIndex &p){
+    return vector_bytes(p.values) + vector_bytes(p.counts) + vector_bytes(p.offsets) + vector_bytes(p.bytes) + vector_bytes(p.bits);
+}
+
+//The token index of an attribute as a member of the corpus
+Index Corpus::* index_member(const std::string &attribute){
+    if(attribute == "word"){
+        return &Corpus::word_index;
+    } else if(attribute == "c5"){
+        return &Corpus::c5_index;
+    } else if(attribute == "lemma"){
+        return &Corpus::lemma_index;
+    } else if(attribute == "pos"){
+        return &Corpus::pos_index;
+    } else if(attribute == "folded_word"){
+        return &Corpus::folded_word_index;
+    } else if(attribute == "folded_lemma"){
+        return &Corpus::folded_lemma_index;
+    }
+    throw std::invalid_argument("Attribute " + attribute + " does not exist");
+}
+
+//Memory of every part of a corpus. Arrays count their capacity, the dictionary also counts the strings
+//too long to be stored inline and a tree node per entry of string2index.
+std::vector<MemoryUsage> corpus_footprint(const Corpus &corpus){
+    std::vector<MemoryUsage> usage;
+    usage.push_back({"tokens", vector_bytes(corpus.tokens)});
+    usage.push_back({"sentences", vector_bytes(corpus.sentences) + vector_bytes(corpus.sentence_tree)});
+    long strings = vector_bytes(corpus.index2string);
+    for(const std::string &s: corpus.index2string){
+        strings += string_bytes(s);
+    }
+    usage.push_back({"index2string", strings});
+    long nodes = corpus.string2index.size() * (map_node_bytes + sizeof(std::pair<const std::string, uint32_t>));
+    for(const auto &[s, id]: corpus.string2index){
+        nodes += string_bytes(s);
+    }
+    usage.push_back({"string2index", nodes});
+    usage.push_back({"folded", vector_bytes(corpus.folded)});
+    for(const std::string &attribute: indexed_attributes){
+        const PackedIndex *packed = packed_index(corpus, attribute);
+        std::string kind = index_kind_name(packed ? packed->kind : IndexKind::plain);
+        usage.push_back({attribute + " index (" + kind + ")", vector_bytes(corpus.*index_member(attribute)) + (packed ? packed_bytes(*packed) : 0)});
+    }
+    for(auto [attribute, index]: {std::pair{"word", &corpus.word_sentences}, {"c5", &corpus.c5_sentences}, {"lemma", &corpus.lemma_sentences},
+                                  {"pos", &corpus.pos_sentences}, {"folded_word", &corpus.folded_word_sentences}, {"folded_lemma", &corpus.folded_lemma_sentences}}){
+        usage.push_back({std::string(attribute) + " sentence index", vector_bytes(index->offsets) + vector_bytes(index->ids)});
+    }
+    long columns = 0;
+    for(const ByteColumn *column: {&corpus.word_column, &corpus.c5_column, &corpus.lemma_column, &corpus.pos_column}){
+        columns += vector_bytes(column->values) + vector_bytes(column->codes);
+    }
+    usage.push_back({"byte columns", columns});
+    usage.push_back({"suffix array", vector_bytes(corpus.word_suffixes)});
+    long views = vector_bytes(corpus.views);
+    for(const MaterializedView &view: corpus.views){
+        views += vector_bytes(view.literals) + vector_bytes(view.positions);
+    }
+    usage.push_back({"views", views});
+    return usage;
+}
+long total_bytes(const std::vector<MemoryUsage> &usage){
+    long total = 0;
+    for(const MemoryUsage &u: usage){
+        total += u.bytes;
+    }
+    return total;
+}
+void print_footprint(std::ostream &out, const std::vector<MemoryUsage> &usage){
+    long total = total_bytes(usage);
+    char line[256];
+    for(const MemoryUsage &u: usage){
+        std::snprintf(line, sizeof(line), "%-32s %10.1f MB %5.1f%%\n", u.component.c_str(), u.bytes / 1048576.0, total ? 100.0 * u.bytes / total : 0);
+        out << line;
+    }
+    std::snprintf(line, sizeof(line), "%-32s %10.1f MB\n", "total", total / 1048576.0);
+    out << line;
+}
+
+IndexKind parse_index_kind(const std::string &name){
+    if(name == "plain"){
+        return IndexKind::plain;
+    } else if(name == "compressed"){
+        return IndexKind::compressed;
+    } else if(name == "bitmap"){
+        return IndexKind::bitmap;
+    } else if(name == "none"){
+        return IndexKind::none;
+    }
+    throw std::invalid_argument("Index kinds are plain, compressed, bitmap or none, not " + name);
+}
+const char *index_kind_name(IndexKind kind){
+    const char *names[] = {"plain", "compressed", "bitmap", "none"};
+    return names[(int)kind];
+}
+//Reads a config such as word=plain,lemma=compressed,pos=bitmap
+IndexConfig parse_index_config(const std::string &text){
+    IndexConfig config;
+    std::istringstream items(text);
+    for(std::string item; std::getline(items, item, ',');){
+        size_t equals = item.find('=');
+        if(equals == std::string::npos){
+            throw std::invalid_argument("Index config entries are ATTRIBUTE=KIND, not " + item);
+        }
+        std::string attribute = item.substr(0, equals);
+        index_member(attribute);
+        config[attribute] = parse_index_kind(item.substr(equals + 1));
+    }
+    return config;
+}
+std::string format_index_config(const IndexConfig &config){
+    std::string text;
+    for(const auto &[attribute, kind]: config){
+        text += (text.empty() ? "" : ",") + attribute + "=" + index_kind_name(kind);
+    }
+    return text;
+}
+
+//Calls f with every value of an attribute and its positions in the plain token index. The index is sorted
+//by value, so counting the values in token order gives where each list starts without reading the tokens
+//the index points to.
+template <typename F>
+void for_each_list(const Corpus &corpus, const std::string &attribute, F f){
+    const Index &index = corpus.*index_member(attribute);
+    if(index.size() != corpus.tokens.size()){
+        throw std::invalid_argument("Attribute " + attribute + " has no plain index");
+    }
+    uint32_t Token::* member = attribute_member(attribute);
+    std::vector<Position> counts(corpus.index2string.size(), 0);
+    for(const Token &t: corpus.tokens){
+        counts[t.*member]++;
+    }
+    std::span<const Position> positions(index);
+    size_t at = 0;
+    for(uint32_t v = 0; v < counts.size(); v++){
+        if(counts[v] > 0){
+            f(v, positions.subspan(at, counts[v]));
+            at += counts[v];
+        }
+    }
+}
+int varint_bytes(uint64_t x){
+    int bytes = 1;
+    for(; x >= 0x80; x >>= 7){
+        bytes++;
+    }
+    return bytes;
+}
+
+//Bytes the index of an attribute would take in each representation, from its plain index. A bitmap is
+//left out for attributes with more than bitmap_max_values values.
+std::map<IndexKind, long> index_sizes(const Corpus &corpus, const std::string &attribute){
+    long lists = 0, gaps = 0;
+    for_each_list(corpus, attribute, [&](uint32_t, std::span<const Position> positions){
+        lists++;
+        Position at = 0;
+        for(Position x: positions){
+            gaps += varint_bytes(x - at);
+            at = x;
+        }
+    });
+    long words = (corpus.tokens.size() + 63) / 64;
+    long values = lists * (sizeof(uint32_t) + sizeof(Position));
+    std::map<IndexKind, long> sizes;
+    sizes[IndexKind::plain] = corpus.tokens.size() * sizeof(Position);
+    sizes[IndexKind::compressed] = values + (lists + 1) * sizeof(uint64_t) + gaps;
+    if(lists <= (long)bitmap_max_values){
+        sizes[IndexKind::bitmap] = values + lists * words * sizeof(uint64_t);
+    }
+    sizes[IndexKind::none] = values;
+    return sizes;
+}
+
+//Builds another representation of the index of an attribute from its plain index
+PackedIndex pack_index(const Corpus &corpus, const std::string &attribute, IndexKind kind){
+    PackedIndex packed;
+    packed.kind = kind;
+    std::vector<std::span<const Position>> lists;
+    for_each_list(corpus, attribute, [&](uint32_t value, std::span<const Position> positions){
+        packed.values.push_back(value);
+        packed.counts.push_back(positions.size());
+        lists.push_back(positions);
+    });
+    packed.values.shrink_to_fit();
+    packed.counts.shrink_to_fit();
+    if(kind == IndexKind::compressed){
+        for(std::span<const Position> positions: lists){
+            packed.offsets.push_back(packed.bytes.size());
+            Position at = 0;
+            for(Position x: positions){
+                uint64_t gap = x - at;
+                for(; gap >= 0x80; gap >>= 7){
+                    packed.bytes.push_back((gap & 0x7F) | 0x80);
+                }
+                packed.bytes.push_back(gap);
+                at = x;
+            }
+        }
+        packed.offsets.push_back(packed.bytes.size());
+        packed.offsets.shrink_to_fit();
+        packed.bytes.shrink_to_fit();
+    } else if(kind == IndexKind::bitmap){
+        if(lists.size() > bitmap_max_values){
+            throw std::invalid_argument("A bitmap index needs an attribute with at most " + std::to_string(bitmap_max_values) + " values, " + attribute + " has more");
+        }
+        packed.words_per_value = (corpus.tokens.size() + 63) / 64;
+        packed.bits.assign(lists.size() * packed.words_per_value, 0);
+        for(size_t i = 0; i < lists.size(); i++){
+            uint64_t *words = packed.bits.data() + i * packed.words_per_value;
+            for(Position x: lists[i]){
+                words[x / 64] |= 1ull << (x % 64);
+            }
+        }
+    }
+    return packed;
+}
+
+//Replaces the plain index of every attribute in the config with its representation and frees the plain one
+void pack_indices(Corpus &corpus, const IndexConfig &config){
+    for(const auto &[attribute, kind]: config){
+        if(kind != IndexKind::plain){
+            corpus.packed[attribute] = pack_index(corpus, attribute, kind);
+            Index().swap(corpus.*index_member(attribute));
+        }
+    }
+}
+
+//Picks index representations that fit a corpus into a memory budget. Starting from config, the attribute
+//with the largest index steps down to its next smaller representation, in the order plain, bitmap,
+//compressed, none, until everything fits. Runs on the plain indices, before pack_indices.
+IndexConfig fit_indices(const Corpus &corpus, long budget_bytes, IndexConfig config){
+    const IndexKind order[] = {IndexKind::plain, IndexKind::bitmap, IndexKind::compressed, IndexKind::none};
+    long fixed = total_bytes(corpus_footprint(corpus));
+    std::map<std::string, std::map<IndexKind, long>> sizes;
+    for(const std::string &attribute: indexed_attributes){
+        fixed -= vector_bytes(corpus.*index_member(attribute));
+        sizes[attribute] = index_sizes(corpus, attribute);
+        IndexKind kind = config.emplace(attribute, IndexKind::plain).first->second;
+        if(!sizes[attribute].count(kind)){
+            throw std::invalid_argument("A bitmap index needs an attribute with at most " + std::to_string(bitmap_max_values) + " values, " + attribute + " has more");
+        }
+    }
+    auto used = [&](){
+        long bytes = fixed;
+        for(const auto &[attribute, kind]: config){
+            bytes += sizes[attribute].at(kind);
+        }
+        return bytes;
+    };
+    while(used() > budget_bytes){
+        std::string largest;
+        for(const auto &[attribute, kind]: config){
+            if(kind != IndexKind::none && (largest.empty() || sizes[attribute][kind] > sizes[largest][config[largest]])){
+                largest = attribute;
+            }
+        }
+        if(largest.empty()){
+            throw std::invalid_argument("The corpus needs " + std::to_string(used() >> 20) + " MB even without indices");
+        }
+        IndexKind &kind = config[largest];
+        const IndexKind *next = std::find(order, order + 4, kind) + 1;
+        while(*next != IndexKind::none && !(sizes[largest].count(*next) && sizes[largest][*next] < sizes[largest][kind])){
+            next++;
+        }
+        kind = *next;
+    }
+    return config;
+}
@@ -0,0 +1,29 @@
+#ifndef FOOTPRINT_H
+#define FOOTPRINT_H
+#include "query_corpora.h"
+#include <ostream>
+//Bytes a part of a loaded corpus takes, from the capacity of its arrays and the nodes and strings of its dictionary
+struct MemoryUsage
+{
+    std::string component;
+    long bytes;
+};
+//Representation of the index of every attribute, attributes that are left out keep a plain index
+using IndexConfig = std::map<std::string, IndexKind>;
+const std::vector<std::string> indexed_attributes = {"word", "c5", "lemma", "pos", "folded_word", "folded_lemma"};
+//A bitmap takes a bit per token for every value, with more values than a byte column holds it is
+//many times the size of the plain index
+const size_t bitmap_max_values = 255;
+std::vector<MemoryUsage> corpus_footprint(const Corpus &corpus);
+long total_bytes(const std::vector<MemoryUsage> &usage);
+void print_footprint(std::ostream &out, const std::vector<MemoryUsage> &usage);
+IndexKind parse_index_kind(const std::string &name);
+const char *index_kind_name(IndexKind kind);
+IndexConfig parse_index_config(const std::string &text);
+std::string format_index_config(const IndexConfig &config);
+Index Corpus::* index_member(const std::string &attribute);
+std::map<IndexKind, long> index_sizes(const Corpus &corpus, const std::string &attribute);
+PackedIndex pack_index(const Corpus &corpus, const std::string &attribute, IndexKind kind);
+void pack_indices(Corpus &corpus, const IndexConfig &config);
+IndexConfig fit_indices(const Corpus &corpus, long budget_bytes, IndexConfig config);
+#endif
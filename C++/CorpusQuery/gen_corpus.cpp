@@ -0,0 +1,203 @@
+#include <iostream>
+#include <fstream>
+#include <random>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cctype>
+#include <map>
+//Writes a synthetic corpus in the tab separated format load_corpus reads, for scaling tests.
+//Lemmas follow a Zipf distribution, frequent lemmas are function words, every lemma has inflected
+//forms with their own c5 tags and sentence lengths follow a log-normal distribution.
+//Usage: gen_corpus OUT.csv [--tokens N] [--vocab V] [--zipf S] [--sentence-mean M] [--seed X]
+
+struct Form
+{
+    std::string word;
+    std::string c5;
+};
+struct Lemma
+{
+    std::string lemma;
+    std::string pos;
+    std::vector<Form> forms;
+    std::vector<double> weights;
+};
+
+//Function words for the most frequent ranks, in the order of a typical English frequency list
+const std::vector<std::pair<std::string, std::string>> function_words = {
+    {"the", "ART"}, {"of", "PREP"}, {"and", "CONJ"}, {"a", "ART"}, {"in", "PREP"}, {"to", "PREP"},
+    {"it", "PRON"}, {"be", "VERB"}, {"that", "CONJ"}, {"for", "PREP"}, {"he", "PRON"}, {"have", "VERB"},
+    {"on", "PREP"}, {"with", "PREP"}, {"I", "PRON"}, {"as", "CONJ"}, {"at", "PREP"}, {"by", "PREP"},
+    {"not", "ADV"}, {"they", "PRON"}, {"this", "ART"}, {"but", "CONJ"}, {"from", "PREP"}, {"she", "PRON"},
+    {"or", "CONJ"}, {"we", "PRON"}, {"do", "VERB"}, {"which", "PRON"}, {"you", "PRON"}, {"an", "ART"}};
+
+//Forms of the irregular function verbs, in the order base, infinitive, -s, past, participle, -ing
+const std::map<std::string, std::vector<std::string>> irregular_verbs = {
+    {"be", {"are", "be", "is", "was", "been", "being"}},
+    {"have", {"have", "have", "has", "had", "had", "having"}},
+    {"do", {"do", "do", "does", "did", "done", "doing"}}};
+
+//Makes a pronounceable word that is unique for every id
+std::string make_word(int id){
+    const char *onsets[] = {"b", "d", "f", "g", "k", "l", "m", "n", "p", "r", "s", "t", "v", "st", "tr", "pl"};
+    const char *vowels[] = {"a", "e", "i", "o", "u", "ai", "ou", "ea"};
+    std::string w;
+    do{
+        w += onsets[id % 16];
+        id /= 16;
+        w += vowels[id % 8];
+        id /= 8;
+    } while(id > 0);
+    return w + "n";
+}
+
+//Inflected forms and how often each one is used, by part of speech
+Lemma make_lemma(const std::string &lemma, const std::string &pos){
+    Lemma l{lemma, pos, {}, {}};
+    auto add = [&l](const std::string &word, const std::string &c5, double weight){
+        l.forms.push_back(Form{word, c5});
+        l.weights.push_back(weight);
+    };
+    if(pos == "SUBST"){
+        add(lemma, "NN1", 0.7);
+        add(lemma + "s", "NN2", 0.3);
+    } else if(pos == "VERB" && irregular_verbs.count(lemma)){
+        //Same order as regular verbs so they share the form weights
+        const std::vector<std::string> &forms = irregular_verbs.at(lemma);
+        const char letter = lemma == "be" ? 'B' : lemma == "have" ? 'H' : 'D';
+        const char *tags[] = {"B", "I", "Z", "D", "N", "G"};
+        double weights[] = {0.2, 0.2, 0.15, 0.2, 0.1, 0.15};
+        for(int i = 0; i < 6; i++){
+            add(forms[i], std::string("V") + letter + tags[i], weights[i]);
+        }
+    } else if(pos == "VERB"){
+        add(lemma, "VVB", 0.2);
+        add(lemma, "VVI", 0.2);
+        add(lemma + "s", "VVZ", 0.15);
+        add(lemma + "ed", "VVD", 0.2);
+        add(lemma + "ed", "VVN", 0.1);
+        add(lemma + "ing", "VVG", 0.15);
+    } else if(pos == "ADJ"){
+        add(lemma, "AJ0", 0.85);
+        add(lemma + "er", "AJC", 0.1);
+        add(lemma + "est", "AJS", 0.05);
+    } else if(pos == "ADV"){
+        add(lemma, "AV0", 1);
+    } else if(pos == "ART"){
+        add(lemma, "AT0", 1);
+    } else if(pos == "PREP"){
+        add(lemma, "PRP", 1);
+    } else if(pos == "CONJ"){
+        add(lemma, "CJC", 1);
+    } else{
+        add(lemma, "PNP", 1);
+    }
+    return l;
+}
+
+int main(int argc, char *argv[]){
+    if(argc < 2){
+        std::cerr << "Usage: gen_corpus OUT.csv [--tokens N] [--vocab V] [--zipf S] [--sentence-mean M] [--seed X]" << std::endl;
+        return 1;
+    }
+    std::string filename = argv[1];
+    long tokens = 1000000;
+    int vocab = 100000;
+    double zipf = 1.07;
+    double sentence_mean = 18;
+    unsigned seed = 1;
+    for(int i = 2; i + 1 < argc; i += 2){
+        std::string arg = argv[i];
+        std::string value = argv[i + 1];
+        if(arg == "--tokens"){
+            tokens = std::stol(value);
+        } else if(arg == "--vocab"){
+            vocab = std::stoi(value);
+        } else if(arg == "--zipf"){
+            zipf = std::stod(value);
+        } else if(arg == "--sentence-mean"){
+            sentence_mean = std::stod(value);
+        } else if(arg == "--seed"){
+            seed = std::stoul(value);
+        } else{
+            std::cerr << "Unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+    std::mt19937_64 rng(seed);
+
+    //Open class lemmas get a part of speech with roughly the proportions of English text
+    std::vector<Lemma> lemmas;
+    std::discrete_distribution<int> open_class({50, 20, 20, 10});
+    const char *open_pos[] = {"SUBST", "VERB", "ADJ", "ADV"};
+    for(int i = 0; i < vocab; i++){
+        if(i < (int)function_words.size()){
+            lemmas.push_back(make_lemma(function_words[i].first, function_words[i].second));
+        } else{
+            lemmas.push_back(make_lemma(make_word(i), open_pos[open_class(rng)]));
+        }
+    }
+    //Form weights only depend on the part of speech, so there is one distribution per part of speech
+    std::map<std::string, std::discrete_distribution<int>> choose_form;
+    for(const Lemma &l: lemmas){
+        if(choose_form.find(l.pos) == choose_form.end()){
+            choose_form[l.pos] = std::discrete_distribution<int>(l.weights.begin(), l.weights.end());
+        }
+    }
+    std::vector<double> weights(vocab);
+    for(int i = 0; i < vocab; i++){
+        weights[i] = 1 / std::pow(i + 1, zipf);
+    }
+    std::discrete_distribution<int> zipf_lemma(weights.begin(), weights.end());
+    //Log-normal sentence lengths with the requested mean and a long tail
+    double sigma = 0.6;
+    std::lognormal_distribution<double> sentence_length(std::log(sentence_mean) - sigma * sigma / 2, sigma);
+    std::bernoulli_distribution comma(0.05);
+
+    std::ofstream f(filename, std::ios::binary);
+    if (!f) {
+        std::cerr << "Unable to open file" << std::endl;
+        return 1;
+    }
+    std::string buffer = "word\tc5\tlemma\tpos\n";
+    auto append = [&buffer](const std::string &word, const std::string &c5, const std::string &lemma, const std::string &pos){
+        buffer += word;
+        buffer += '\t';
+        buffer += c5;
+        buffer += '\t';
+        buffer += lemma;
+        buffer += '\t';
+        buffer += pos;
+        buffer += '\n';
+    };
+    long written = 0;
+    while(written < tokens){
+        int length = std::max(1L, std::min(tokens - written - 1, std::lround(sentence_length(rng))));
+        for(int i = 0; i < length; i++){
+            Lemma &l = lemmas[zipf_lemma(rng)];
+            const Form &form = l.forms[choose_form[l.pos](rng)];
+            if(i == 0){
+                std::string word = form.word;
+                word[0] = std::toupper((unsigned char)word[0]);
+                append(word, form.c5, l.lemma, l.pos);
+            } else{
+                append(form.word, form.c5, l.lemma, l.pos);
+            }
+            if(i + 1 < length && comma(rng)){
+                append(",", "PUN", ",", "PUN");
+                written++;
+            }
+        }
+        append(".", "PUN", ".", "PUN");
+        buffer += '\n';
+        written += length + 1;
+        if(buffer.size() >= (1 << 22)){
+            f.write(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+    }
+    f.write(buffer.data(), buffer.size());
+    std::cerr << "Wrote " << written << " tokens to " << filename << std::endl;
+    return 0;
+}
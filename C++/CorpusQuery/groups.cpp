@@ -0,0 +1,166 @@
+#include <thread>
+#include <exception>
+#include <algorithm>
+#include <cstdio>
+#include "groups.h"
+
+//Sorts ids with a least significant digit radix sort, only the digits the largest id has are sorted by
+void radix_sort(std::vector<uint32_t> &keys, uint32_t max_key){
+    const uint32_t mask = (1u << radix_bits) - 1;
+    std::vector<uint32_t> buffer;
+    for(int shift = 0; shift < 32 && (max_key >> shift) > 0; shift += radix_bits){
+        if(buffer.empty()){
+            charge_budget(keys.size() * sizeof(uint32_t));
+            buffer.resize(keys.size());
+        }
+        std::vector<size_t> start((1 << radix_bits) + 1, 0);
+        for(uint32_t k: keys){
+            start[((k >> shift) & mask) + 1]++;
+        }
+        for(size_t d = 1; d < start.size(); d++){
+            start[d] += start[d - 1];
+        }
+        for(uint32_t k: keys){
+            buffer[start[(k >> shift) & mask]++] = k;
+        }
+        keys.swap(buffer);
+        poll_budget(keys.size());
+    }
+}
+
+//Sorts the ids and counts the runs of equal ones, for few hits compared to the dictionary
+std::vector<Group> count_sorted(std::vector<uint32_t> &keys, uint32_t max_key){
+    if(keys.size() < radix_min_keys){
+        std::sort(keys.begin(), keys.end());
+    } else{
+        radix_sort(keys, max_key);
+    }
+    std::vector<Group> groups;
+    for(size_t i = 0; i < keys.size();){
+        size_t j = i;
+        while(j < keys.size() && keys[j] == keys[i]){
+            j++;
+        }
+        groups.push_back(Group{keys[i], (long)(j - i)});
+        i = j;
+    }
+    return groups;
+}
+
+//Frequency list of the values an attribute has at an offset in the hits of a query, no matches are
+//built. The start positions are split into one range per thread, and every thread evaluates the plan
+//over its range. Each thread keeps the ids of its hits until they are many compared to the dictionary,
+//then counts them in its own array instead. The arrays are added up, the ids that are left radix sorted.
+Grouping group_matches(const Corpus &corpus, const Query &query, const GroupOptions &options){
+    uint32_t Token::* attribute = attribute_member(options.attribute);
+    int size = query.size();
+    QueryPlan plan = plan_query(corpus, query);
+    //There are at most as many hits as positions in the smallest list or the range
+    size_t bound = plan.scan || plan.include.empty() ? get_size(plan.range) : plan.include[0].elems.size();
+    size_t num_values = corpus.index2string.size();
+    int threads = options.threads > 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    threads = std::clamp<int>(bound / group_min_keys, 1, threads);
+    std::vector<std::vector<uint32_t>> counts(threads);
+    std::vector<std::vector<uint32_t>> keys(threads);
+    std::vector<std::exception_ptr> errors(threads);
+    QueryBudget *budget = active_budget;
+    size_t dense_keys = std::max<size_t>(num_values * group_dense_percent / 100 / threads, 1);
+    auto work = [&](int t){
+        WorkerBudgetScope scope(budget);
+        try{
+            QueryPlan part = plan;
+            long length = get_size(plan.range);
+            part.range.first = plan.range.first + length * t / threads;
+            part.range.last = plan.range.first + length * (t + 1) / threads - 1;
+            SentenceCursor cursor{corpus};
+            Match m;
+            for_each_position(part, [&](Position p){
+                if(!cursor.to_match(p, size, m)){
+                    return;
+                }
+                Position at = p + options.offset;
+                if(at >= corpus.sentences[m.sentence] && at < corpus.sentences[m.sentence + 1]){
+                    uint32_t key = corpus.tokens[at].*attribute;
+                    if(!counts[t].empty()){
+                        counts[t][key]++;
+                        return;
+                    }
+                    push_charged(keys[t], key);
+                    if(keys[t].size() >= dense_keys){
+                        charge_budget(num_values * sizeof(uint32_t));
+                        counts[t].assign(num_values, 0);
+                        for(uint32_t k: keys[t]){
+                            counts[t][k]++;
+                        }
+                        keys[t] = std::vector<uint32_t>();
+                    }
+                }
+            });
+        } catch(...){
+            errors[t] = std::current_exception();
+        }
+    };
+    std::vector<std::thread> workers;
+    for(int t = 1; t < threads; t++){
+        workers.emplace_back(work, t);
+    }
+    work(0);
+    for(std::thread &w: workers){
+        w.join();
+    }
+    for(std::exception_ptr &e: errors){
+        if(e){
+            std::rethrow_exception(e);
+        }
+    }
+
+    Grouping grouping;
+    std::vector<Group> groups;
+    auto dense = std::find_if(counts.begin(), counts.end(), [](const std::vector<uint32_t> &c){ return !c.empty(); });
+    if(dense != counts.end()){
+        //Threads that kept their ids add them to one of the arrays
+        std::vector<uint32_t> &total = *dense;
+        for(int t = 0; t < threads; t++){
+            for(uint32_t k: keys[t]){
+                total[k]++;
+            }
+        }
+        for(size_t v = 0; v < num_values; v++){
+            long count = 0;
+            for(int t = 0; t < threads; t++){
+                count += counts[t].empty() ? 0 : counts[t][v];
+            }
+            if(count > 0){
+                groups.push_back(Group{(uint32_t)v, count});
+            }
+            grouping.hits += count;
+        }
+    } else{
+        for(int t = 1; t < threads; t++){
+            keys[0].insert(keys[0].end(), keys[t].begin(), keys[t].end());
+        }
+        grouping.hits = keys[0].size();
+        groups = count_sorted(keys[0], keys[0].empty() ? 0 : *std::max_element(keys[0].begin(), keys[0].end()));
+    }
+    grouping.values = groups.size();
+    size_t top = std::min<size_t>(std::max(options.top, 0), groups.size());
+    std::partial_sort(groups.begin(), groups.begin() + top, groups.end(), [](const Group &a, const Group &b){
+        return a.count != b.count ? a.count > b.count : a.value < b.value;
+    });
+    groups.resize(top);
+    grouping.top = groups;
+    return grouping;
+}
+
+//Prints groups as a table with the share of the hits
+void print_groups(std::ostream &out, const Corpus &corpus, const Grouping &grouping){
+    char line[256];
+    std::snprintf(line, sizeof(line), "%-20s %10s %8s\n", "value", "count", "%");
+    out << line;
+    for(const Group &g: grouping.top){
+        std::snprintf(line, sizeof(line), "%-20s %10ld %8.2f\n", corpus.index2string[g.value].c_str(), g.count, 100.0 * g.count / grouping.hits);
+        out << line;
+    }
+    std::snprintf(line, sizeof(line), "%ld hits, %ld values\n", grouping.hits, grouping.values);
+    out << line;
+}
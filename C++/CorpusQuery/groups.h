@@ -0,0 +1,38 @@
+#ifndef GROUPS_H
+#define GROUPS_H
+#include "query_corpora.h"
+#include <ostream>
+struct GroupOptions
+{
+    //Attribute the hits are grouped by, read from the token at offset from the start of each hit.
+    //Offsets outside the hit read its context, hits whose token would be outside the sentence are left out.
+    std::string attribute = "word";
+    int offset = 0;
+    //Number of groups returned, the largest first
+    int top = 20;
+    //0 uses one thread per core
+    int threads = 0;
+};
+struct Group
+{
+    uint32_t value;
+    long count;
+};
+struct Grouping
+{
+    //Hits that were grouped and the number of distinct values among them
+    long hits = 0;
+    long values = 0;
+    std::vector<Group> top;
+};
+//Possible hits per thread below which no more threads are started
+const size_t group_min_keys = 1 << 18;
+//Counted in one array per thread when there are at least this many hits per 100 dictionary entries, radix sorted otherwise
+const size_t group_dense_percent = 25;
+const int radix_bits = 11;
+//Fewer keys are sorted with std::sort, the digit histograms would cost more than sorting them
+const size_t radix_min_keys = 1024;
+Grouping group_matches(const Corpus &corpus, const Query &query, const GroupOptions &options);
+void radix_sort(std::vector<uint32_t> &keys, uint32_t max_key);
+void print_groups(std::ostream &out, const Corpus &corpus, const Grouping &grouping);
+#endif
@@ -0,0 +1,116 @@
+#include <algorithm>
+#include "kwic.h"
+//The buffer is written to the stream once it grows past this size
+const size_t flush_size = 1 << 16;
+const char *match_color = "\033[36m";
+const char *context_color = "\033[37m";
+
+KwicFormatter::KwicFormatter(const Corpus &corpus, std::ostream &out, KwicOptions options) : KwicFormatter(corpus, corpus.index2string, out, options){
+}
+KwicFormatter::KwicFormatter(const Corpus &corpus, const std::vector<std::string> &strings, std::ostream &out, KwicOptions options) : corpus(corpus), strings(strings), out(out), options(options){
+    buffer.reserve(2 * flush_size);
+}
+KwicFormatter::~KwicFormatter(){
+    flush();
+}
+
+//Renders the page of matches selected by offset and limit, returns the number of rendered matches
+int KwicFormatter::write(const std::vector<Match> &matches){
+    int first = std::clamp(options.offset, 0, (int)matches.size());
+    int last = matches.size();
+    if(options.limit >= 0){
+        last = std::min(last, first + options.limit);
+    }
+    for(int i = first; i < last; i++){
+        write(matches[i]);
+    }
+    flush();
+    return last - first;
+}
+
+//Renders a single match as one line
+void KwicFormatter::write(const Match &m){
+    Position first = corpus.sentences[m.sentence];
+    Position last = corpus.sentences[m.sentence + 1];
+    Position start = first + m.pos;
+    Position end = start + m.len;
+    if(options.color){
+        buffer += context_color;
+    }
+    append_left(first, start);
+    append_match(start, end);
+    append_right(end, last);
+    buffer += '\n';
+    if(buffer.size() >= flush_size){
+        flush();
+    }
+}
+
+//Writes everything in the buffer to the stream
+void KwicFormatter::flush(){
+    out.write(buffer.data(), buffer.size());
+    buffer.clear();
+}
+
+//Left context is right aligned so all matches start in the same column
+void KwicFormatter::append_left(Position first, Position start){
+    Position from = start;
+    if(options.width <= 0){
+        from = first;
+    } else{
+        //Walk backwards until the next token would not fit
+        int width = 0;
+        while(from > first){
+            int w = display_width(strings[corpus.tokens[from - 1].word]) + 1;
+            if(width + w > options.width){
+                break;
+            }
+            width += w;
+            from--;
+        }
+        buffer.append(options.width - width, ' ');
+    }
+    for(Position i = from; i < start; i++){
+        buffer += strings[corpus.tokens[i].word];
+        buffer += ' ';
+    }
+}
+
+void KwicFormatter::append_match(Position start, Position end){
+    if(options.color){
+        buffer += match_color;
+    }
+    for(Position i = start; i < end; i++){
+        if(i > start){
+            buffer += ' ';
+        }
+        buffer += strings[corpus.tokens[i].word];
+    }
+    if(options.color){
+        buffer += context_color;
+    }
+}
+
+//Right context stops at the first token that does not fit
+void KwicFormatter::append_right(Position end, Position last){
+    int width = 0;
+    for(Position i = end; i < last; i++){
+        const std::string &s = strings[corpus.tokens[i].word];
+        int w = display_width(s) + 1;
+        if(options.width > 0 && width + w > options.width){
+            break;
+        }
+        buffer += ' ';
+        buffer += s;
+        width += w;
+    }
+}
+
+//Number of characters in a UTF-8 string, continuation bytes are not counted
+int display_width(const std::string &s){
+    int width = 0;
+    for(unsigned char c: s){
+        width += (c & 0xC0) != 0x80;
+    }
+    return width;
+}
@@ -0,0 +1,37 @@
+#ifndef KWIC_H
+#define KWIC_H
+#include "query_corpora.h"
+#include <ostream>
+struct KwicOptions
+{
+    //Characters of context on each side of the match, 0 prints the whole sentence
+    int width = 40;
+    //Index of the first match to render and the maximum number to render, -1 renders all
+    int offset = 0;
+    int limit = -1;
+    //Highlight the match with terminal colors
+    bool color = true;
+};
+//Renders matches as keyword in context lines. Lines are written into one reusable buffer
+//which is written to the stream in large blocks, so rendering is bound by I/O.
+class KwicFormatter
+{
+const Corpus &corpus;
+//Strings of the word ids, the corpus's own unless it shares a dictionary like a segment does
+const std::vector<std::string> &strings;
+std::ostream &out;
+KwicOptions options;
+std::string buffer;
+void append_left(Position first, Position start);
+void append_match(Position start, Position end);
+void append_right(Position end, Position last);
+public:
+    KwicFormatter(const Corpus &corpus, std::ostream &out, KwicOptions options);
+    KwicFormatter(const Corpus &corpus, const std::vector<std::string> &strings, std::ostream &out, KwicOptions options);
+    ~KwicFormatter();
+    int write(const std::vector<Match> &matches);
+    void write(const Match &m);
+    void flush();
+};
+int display_width(const std::string &s);
+#endif
@@ -1,44 +1,357 @@
 #include "query_corpora.h"
+#include "kwic.h"
+#include "export.h"
+#include "batch.h"
+#include "collocations.h"
+#include "groups.h"
+#include "estimate.h"
+#include "reload.h"
+#include "segments.h"
 #include <iostream>
-int main(){
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <csignal>
+const int page_size = 10;
+//Offset of the first match on page n, pages are numbered from 1
+int page_offset(const std::string &n){
+    int page = std::stoi(n);
+    if(page < 1){
+        throw std::invalid_argument("Pages are numbered from 1");
+    }
+    return (page - 1) * page_size;
+}
+//Limits of the interactive queries, Ctrl-C cancels the query that is running
+QueryBudget repl_budget;
+void cancel_query(int){
+    repl_budget.cancelled = true;
+}
+//Runs the queries in a file and writes counts and timings to stdout, returns the exit code
+int run_batch_mode(const Corpus &c, const std::string &filename, const BatchOptions &options){
+    std::vector<std::string> queries;
+    try{
+        queries = read_queries(filename);
+    } catch(const std::invalid_argument &e){
+        //Scheduled jobs only see the exit code
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    auto start = std::chrono::steady_clock::now();
+    std::vector<BatchResult> results = run_batch(c, queries, options);
+    std::chrono::duration<double, std::milli> d = std::chrono::steady_clock::now() - start;
+    write_results(std::cout, results);
+    std::cerr << queries.size() << " queries in " << d.count() << " ms" << std::endl;
+    return 0;
+}
+//Loads the corpus and the appended files as segments that are merged in the background, then answers
+//queries over all segments. :append FILE adds another segment while the prompt keeps running.
+int run_segmented_mode(const std::string &corpus_file, const std::vector<std::string> &appended, bool suffix_array){
+    SegmentedCorpus corpus;
+    corpus.suffix_array = suffix_array;
+    start_merger(corpus);
+    try{
+        append_segment(corpus, corpus_file);
+        for(const std::string &filename: appended){
+            append_segment(corpus, filename);
+        }
+    } catch(const std::invalid_argument &e){
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    std::string input;
+    KwicOptions options;
+    options.limit = page_size;
+    std::vector<Match> matches;
+    //Segments the matches were found in, a merge replaces segments but these stay valid for later pages
+    std::vector<SegmentPtr> shown = snapshot(corpus);
+    std::cout << "Enter query, :page N, :append FILE, :compact, :segments or nothing to quit: ";
+    std::getline(std::cin, input);
+    while(!input.empty()){
+        repl_budget.cancelled = false;
+        std::signal(SIGINT, cancel_query);
+        try{
+            BudgetScope budget(repl_budget);
+            bool render = true;
+            if(input.rfind(":page ", 0) == 0){
+                options.offset = page_offset(input.substr(6));
+            } else if(input.rfind(":append ", 0) == 0){
+                append_segment(corpus, input.substr(8));
+                render = false;
+            } else if(input == ":compact"){
+                compact(corpus);
+                render = false;
+            } else if(input == ":segments"){
+                std::vector<SegmentPtr> segments = snapshot(corpus);
+                for(const SegmentPtr &segment: segments){
+                    std::cout << segment->corpus.tokens.size() << " tokens, " << segment->corpus.sentences.size() - 1 << " sentences" << std::endl;
+                }
+                std::cout << segments.size() << " segments, " << num_tokens(segments) << " tokens, " << num_sentences(segments) << " sentences" << std::endl;
+                render = false;
+            } else{
+                shown = snapshot(corpus);
+                matches = match2(shown, parse_query(input, corpus));
+                options.offset = 0;
+            }
+            if(render){
+                if(matches.empty()){
+                    std::cout << "No matches found" << std::endl;
+                }
+                //Matches are rendered one at a time from the segment that holds them, with local sentence ids
+                int first = std::min(options.offset, (int)matches.size());
+                int last = std::min((int)matches.size(), first + page_size);
+                for(int i = first; i < last; i++){
+                    const Segment &segment = find_segment(shown, matches[i].sentence);
+                    Match local = matches[i];
+                    local.sentence -= segment.sentence_offset;
+                    KwicFormatter kwic(segment.corpus, corpus.dictionary.index2string, std::cout, options);
+                    kwic.write(local);
+                }
+                if(last > first && (int)matches.size() > last - first){
+                    std::cout << "Showing " << first + 1 << "-" << last << " of " << matches.size() << " matches" << std::endl;
+                }
+            }
+        } catch(const std::invalid_argument &e){
+            std::cerr << "Error: " << e.what() << std::endl;
+        } catch(const QueryAborted &e){
+            std::cerr << "Error: " << e.what() << std::endl;
+        }
+        std::signal(SIGINT, SIG_DFL);
+        std::cout << "\033[37m" << "Enter query: ";
+        std::getline(std::cin, input);
+    }
+    stop_merger(corpus);
+    return 0;
+}
+//Usage: main [--corpus FILE] [--append FILE]... [--suffix-array on|off] [--pages small|huge] [--numa local|interleave] [--timeout MS] [--max-memory MB] [--views COMBINATIONS] [--indices word=plain,lemma=compressed,...] [--index-budget MB] [--batch QUERIES [--hits PREFIX] [--format jsonl|tsv|bin] [--attrs word,lemma] [--threads N]]
+int main(int argc, char *argv[]){
     std::string input;
-    std::cout << "Loading corpus..." << std::endl;
-    Corpus c = load_corpus("bnc-05M.csv");
-    build_indices(c);
-    std::cout << "Enter query (or nothing to quit): ";
+    std::string corpus_file = "bnc-05M.csv";
+    std::string batch_file;
+    std::vector<std::string> appended;
+    BatchOptions batch;
+    SnapshotOptions snapshot_options;
+    std::string pages = "small";
+    std::string numa = "local";
+    try{
+        for(int i = 1; i + 1 < argc; i += 2){
+            std::string arg = argv[i];
+            std::string value = argv[i + 1];
+            if(arg == "--corpus"){
+                corpus_file = value;
+            } else if(arg == "--append"){
+                appended.push_back(value);
+            } else if(arg == "--suffix-array"){
+                if(value != "on" && value != "off"){
+                    throw std::invalid_argument("--suffix-array takes on or off");
+                }
+                snapshot_options.suffix_array = value == "on";
+            } else if(arg == "--pages"){
+                pages = value;
+            } else if(arg == "--numa"){
+                numa = value;
+            } else if(arg == "--timeout"){
+                repl_budget.time_ms = std::stod(value);
+            } else if(arg == "--max-memory"){
+                repl_budget.memory_bytes = std::stol(value) << 20;
+            } else if(arg == "--indices"){
+                snapshot_options.indices = parse_index_config(value);
+            } else if(arg == "--index-budget"){
+                snapshot_options.memory_budget = std::stol(value) << 20;
+            } else if(arg == "--views"){
+                snapshot_options.views = value;
+            } else if(arg == "--batch"){
+                batch_file = value;
+            } else if(arg == "--hits"){
+                batch.hits_prefix = value;
+            } else if(arg == "--format"){
+                batch.format = parse_format(value);
+            } else if(arg == "--attrs"){
+                batch.attributes.clear();
+                std::istringstream attr_stream(value);
+                for(std::string a; std::getline(attr_stream, a, ',');){
+                    attribute_member(a);
+                    batch.attributes.push_back(a);
+                }
+            } else if(arg == "--threads"){
+                batch.threads = std::stoi(value);
+            } else{
+                throw std::invalid_argument("Unknown option " + arg);
+            }
+        }
+        snapshot_options.placement = parse_placement(pages, numa);
+        if(!appended.empty() && !batch_file.empty()){
+            throw std::invalid_argument("--append starts the segmented prompt, it can not be combined with --batch");
+        }
+        if(!appended.empty() && (!snapshot_options.views.empty() || !snapshot_options.indices.empty() || snapshot_options.memory_budget > 0)){
+            throw std::invalid_argument("Segments keep plain indices, --append can not be combined with --views, --indices or --index-budget");
+        }
+    } catch(const std::invalid_argument &e){
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    std::cerr << "Loading corpus..." << std::endl;
+    if(!appended.empty()){
+        return run_segmented_mode(corpus_file, appended, snapshot_options.suffix_array);
+    }
+    LiveCorpus live;
+    try{
+        publish(live, load_snapshot(corpus_file, snapshot_options));
+    } catch(const std::invalid_argument &e){
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    if(!batch_file.empty()){
+        batch.time_ms = repl_budget.time_ms;
+        batch.memory_bytes = repl_budget.memory_bytes;
+        return run_batch_mode(*acquire(live), batch_file, batch);
+    }
+    KwicOptions options;
+    options.limit = page_size;
+    std::vector<Match> matches;
+    //Snapshot the matches were found in, later pages are rendered from it even after a reload
+    CorpusPtr shown = acquire(live);
+    bool trace = false;
+    //Hits of :within are whole sentences, they are rendered without context alignment
+    bool sentence_hits = false;
+    std::cout << "Enter query, :page N, :width N (0 for whole sentences), :trace on|off, :within QUERY, :estimate QUERY, :reload FILE, :memory, :colloc ATTR LEFT RIGHT mi|t|ll QUERY, :group ATTR OFFSET QUERY, :export jsonl|tsv|bin FILE ATTRS QUERY or nothing to quit: ";
     std::getline(std::cin, input);
     while(!input.empty()){
+        repl_budget.cancelled = false;
+        std::signal(SIGINT, cancel_query);
         try{
-            Query q = parse_query(input, c);
-            std::vector<Match> matches = match2(c,q);
-            if(matches.empty()){
-                std::cout << "No matches found" << std::endl;
+            BudgetScope budget(repl_budget);
+            //Every command runs on the snapshot that is current when it starts
+            CorpusPtr snapshot = acquire(live);
+            const Corpus &c = *snapshot;
+            bool render = true;
+            if(input.rfind(":page ", 0) == 0){
+                options.offset = page_offset(input.substr(6));
+            } else if(input.rfind(":reload ", 0) == 0){
+                //Queries keep running on the current snapshot until the new corpus is indexed
+                reload(live, input.substr(8), snapshot_options);
+                std::cout << "Loading " << input.substr(8) << " in the background" << std::endl;
+                render = false;
+            } else if(input == ":memory"){
+                print_footprint(std::cout, corpus_footprint(c));
+                render = false;
+            } else if(input == ":trace on" || input == ":trace off"){
+                trace = input == ":trace on";
+                render = false;
+            } else if(input.rfind(":width ", 0) == 0){
+                options.width = std::stoi(input.substr(7));
+                render = false;
+            } else if(input.rfind(":export ", 0) == 0){
+                //:export FORMAT FILE ATTRS QUERY, attributes are separated by commas
+                std::istringstream command(input.substr(8));
+                std::string format, filename, attrs, query;
+                command >> format >> filename >> attrs;
+                std::getline(command, query);
+                std::vector<std::string> attributes;
+                std::istringstream attr_stream(attrs);
+                for(std::string a; std::getline(attr_stream, a, ',');){
+                    //Checked before the file is created, so a typo does not leave an empty file behind
+                    attribute_member(a);
+                    attributes.push_back(a);
+                }
+                ExportFormat f = parse_format(format);
+                Query q = parse_query(query, c);
+                std::ofstream out(filename, std::ios::binary);
+                if(!out){
+                    throw std::invalid_argument("Unable to open " + filename);
+                }
+                MatchExporter exporter(c, out, f, attributes);
+                long exported = export_matches(c, q, exporter);
+                std::cout << "Exported " << exported << " matches to " << filename << std::endl;
+                render = false;
+            } else if(input.rfind(":colloc ", 0) == 0){
+                //:colloc ATTR LEFT RIGHT mi|t|ll QUERY, the top collocates in windows around the hits
+                std::istringstream command(input.substr(8));
+                CollocationOptions colloc;
+                std::string measure, query;
+                command >> colloc.attribute >> colloc.left >> colloc.right >> measure;
+                std::getline(command, query);
+                if(!command){
+                    throw std::invalid_argument("Usage: :colloc ATTR LEFT RIGHT mi|t|ll QUERY");
+                }
+                colloc.measure = parse_measure(measure);
+                print_collocations(std::cout, c, collocations(c, parse_query(query, c), colloc));
+                render = false;
+            } else if(input.rfind(":group ", 0) == 0){
+                //:group ATTR OFFSET QUERY, the most frequent values of the attribute at the offset in the hits
+                std::istringstream command(input.substr(7));
+                GroupOptions group;
+                std::string query;
+                command >> group.attribute >> group.offset;
+                std::getline(command, query);
+                if(!command){
+                    throw std::invalid_argument("Usage: :group ATTR OFFSET QUERY");
+                }
+                print_groups(std::cout, c, group_matches(c, parse_query(query, c), group));
+                render = false;
+            } else if(input.rfind(":estimate ", 0) == 0){
+                //Approximate count from a random sample of the corpus within a time budget, with a few examples
+                EstimateOptions estimate_options;
+                Estimate estimate = estimate_matches(c, parse_query(input.substr(10), c), estimate_options);
+                print_estimate(std::cout, c, estimate, estimate_options);
+                matches = estimate.examples;
+                shown = snapshot;
+                sentence_hits = false;
+                options.offset = 0;
+            } else if(input.rfind(":within ", 0) == 0){
+                //Whole sentences that contain a match for every clause, in any order
+                Query q = parse_query(input.substr(8), c);
+                std::vector<Position> sentences;
+                if(trace){
+                    QueryTrace t;
+                    TraceScope scope(t);
+                    sentences = match_sentences(c, q);
+                    print_trace(std::cout, t);
+                } else{
+                    sentences = match_sentences(c, q);
+                }
+                matches.clear();
+                shown = snapshot;
+                for(Position s: sentences){
+                    matches.push_back(Match{s, 0, (int)(c.sentences[s + 1] - c.sentences[s])});
+                }
+                sentence_hits = true;
+                options.offset = 0;
+            } else{
+                Query q = parse_query(input, c);
+                if(trace){
+                    QueryTrace t;
+                    TraceScope scope(t);
+                    matches = match2(c,q);
+                    print_trace(std::cout, t);
+                } else{
+                    matches = match2(c,q);
+                }
+                shown = snapshot;
+                sentence_hits = false;
+                options.offset = 0;
             }
-            int count = 0;
-            for(Match m:matches){
-                count++;
-                int pos = 0;
-                int length = 1;
-                bool start = false;
-                for(int i = c.sentences[m.sentence]; i < c.sentences[m.sentence + 1]; i++){
-                    if(pos == m.pos){
-                        start = true;
-                    }
-                    if(start && length <= m.len){
-                        std::cout << "\033[36m" << c.index2string[c.tokens[i].word] << " ";
-                        length++;
-                    } else{
-                        std::cout << "\033[37m" << c.index2string[c.tokens[i].word] << " ";
-                    }
-                    pos++;
-                }
-                std::cout << std::endl;
-                if(count >= 10){break;}
+            if(render){
+                if(matches.empty()){
+                    std::cout << "No matches found" << std::endl;
+                }
+                KwicOptions render_options = options;
+                if(sentence_hits){
+                    render_options.width = 0;
+                }
+                KwicFormatter kwic(*shown, std::cout, render_options);
+                int rendered = kwic.write(matches);
+                if(rendered > 0 && (int)matches.size() > rendered){
+                    std::cout << "Showing " << options.offset + 1 << "-" << options.offset + rendered
+                              << " of " << matches.size() << " matches" << std::endl;
+                }
             }
         } catch(const std::invalid_argument &e){
             std::cerr << "Error: " << e.what() << std::endl;
+        } catch(const QueryAborted &e){
+            std::cerr << "Error: " << e.what() << std::endl;
         }
+        std::signal(SIGINT, SIG_DFL);
         std::cout << "\033[37m" << "Enter query: ";
         std::getline(std::cin, input);
     }
-} 
+}
\ No newline at end of file
@@ -0,0 +1,136 @@
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "placement.h"
+//Not in older C library headers, the values are those of the kernel
+#ifndef MADV_COLLAPSE
+#define MADV_COLLAPSE 25
+#endif
+const int mpol_interleave = 3;
+const unsigned mpol_mf_move = 1 << 1;
+
+//Calls f with the bytes of every large array of the corpus
+template <typename F>
+void for_each_array(Corpus &corpus, F f){
+    auto bytes = [&f](auto &v){
+        f((char *)v.data(), v.size() * sizeof(v[0]));
+    };
+    bytes(corpus.tokens);
+    bytes(corpus.sentences);
+    bytes(corpus.sentence_tree);
+    for(Index *index: {&corpus.word_index, &corpus.c5_index, &corpus.lemma_index, &corpus.pos_index,
+                       &corpus.folded_word_index, &corpus.folded_lemma_index, &corpus.word_suffixes}){
+        bytes(*index);
+    }
+    for(SentenceIndex *index: {&corpus.word_sentences, &corpus.c5_sentences, &corpus.lemma_sentences, &corpus.pos_sentences,
+                               &corpus.folded_word_sentences, &corpus.folded_lemma_sentences}){
+        bytes(index->offsets);
+        bytes(index->ids);
+    }
+    for(ByteColumn *column: {&corpus.word_column, &corpus.c5_column, &corpus.lemma_column, &corpus.pos_column}){
+        bytes(column->codes);
+    }
+    for(MaterializedView &view: corpus.views){
+        bytes(view.positions);
+    }
+    for(auto &[attribute, packed]: corpus.packed){
+        bytes(packed.bytes);
+        bytes(packed.bits);
+    }
+}
+
+//Moves the arrays of a built corpus to huge pages and interleaves them over the NUMA nodes. The arrays
+//are already in memory, so the huge pages are collapsed from the small ones right away where the kernel
+//supports it, otherwise the background collapse of transparent huge pages picks them up later.
+PlacementReport place_corpus(Corpus &corpus, const PlacementOptions &options){
+    PlacementReport report;
+    std::vector<int> nodes = numa_nodes();
+    report.nodes = nodes.size();
+    unsigned long mask = 0;
+    for(int n: nodes){
+        mask |= n < 64 ? 1ul << n : 0;
+    }
+    long page = sysconf(_SC_PAGESIZE);
+    for_each_array(corpus, [&](char *data, long size){
+        report.bytes += size;
+        if(options.huge_pages){
+            //Only whole huge pages inside the array can be backed by one
+            uintptr_t first = ((uintptr_t)data + huge_page_size - 1) & ~(uintptr_t)(huge_page_size - 1);
+            uintptr_t last = ((uintptr_t)data + size) & ~(uintptr_t)(huge_page_size - 1);
+            if(first < last){
+                if(madvise((void *)first, last - first, MADV_HUGEPAGE) != 0){
+                    report.error = std::string("madvise: ") + std::strerror(errno);
+                } else{
+                    //Fails on kernels before 6.1 or without free huge pages, which is not an error
+                    madvise((void *)first, last - first, MADV_COLLAPSE);
+                }
+            }
+        }
+        if(options.interleave && nodes.size() > 1){
+            uintptr_t first = (uintptr_t)data & ~(uintptr_t)(page - 1);
+            uintptr_t last = (uintptr_t)data + size;
+            if(size > 0 && syscall(SYS_mbind, first, last - first, mpol_interleave, &mask, 64, mpol_mf_move) != 0){
+                report.error = std::string("mbind: ") + std::strerror(errno);
+            }
+        }
+    });
+    report.huge_bytes = huge_page_bytes();
+    return report;
+}
+
+//Gets placement options from the names used on the command line
+PlacementOptions parse_placement(const std::string &pages, const std::string &numa){
+    PlacementOptions options;
+    if(pages != "small" && pages != "huge"){
+        throw std::invalid_argument("Page size " + pages + " does not exist, use small or huge");
+    }
+    if(numa != "local" && numa != "interleave"){
+        throw std::invalid_argument("NUMA policy " + numa + " does not exist, use local or interleave");
+    }
+    options.huge_pages = pages == "huge";
+    options.interleave = numa == "interleave";
+    return options;
+}
+
+//Online NUMA nodes, from a list like 0-3,6
+std::vector<int> numa_nodes(){
+    std::vector<int> nodes;
+    std::ifstream f("/sys/devices/system/node/online");
+    std::string range;
+    while(std::getline(f, range, ',')){
+        int first = 0;
+        char dash;
+        std::istringstream r(range);
+        r >> first;
+        int last = first;
+        if(r >> dash){
+            r >> last;
+        }
+        for(int n = first; n <= last; n++){
+            nodes.push_back(n);
+        }
+    }
+    if(nodes.empty()){
+        nodes.push_back(0);
+    }
+    return nodes;
+}
+
+//Anonymous memory of this process in transparent huge pages
+long huge_page_bytes(){
+    std::ifstream f("/proc/self/smaps_rollup");
+    std::string key;
+    long kb = 0;
+    while(f >> key){
+        if(key == "AnonHugePages:"){
+            f >> kb;
+            break;
+        }
+    }
+    return kb * 1024;
+}
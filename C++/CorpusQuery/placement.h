@@ -0,0 +1,27 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+#include "query_corpora.h"
+//How the large arrays of a corpus (tokens, indices, sentence indices, byte columns, suffix array, views, packed indices) are
+//placed in memory. Lookups into them are random, so most of their cost is TLB misses and remote memory.
+struct PlacementOptions
+{
+    //Back the arrays with 2 MB transparent huge pages, one TLB entry then covers 512 times more of them
+    bool huge_pages = false;
+    //Spread the pages of every array over all NUMA nodes, so workers on every socket see the same latency
+    bool interleave = false;
+};
+struct PlacementReport
+{
+    //Bytes in the placed arrays and of the process in huge pages afterwards
+    long bytes = 0;
+    long huge_bytes = 0;
+    int nodes = 1;
+    //Set if the kernel refused a request, the arrays then stay where they were
+    std::string error;
+};
+const long huge_page_size = 2 << 20;
+PlacementReport place_corpus(Corpus &corpus, const PlacementOptions &options);
+PlacementOptions parse_placement(const std::string &pages, const std::string &numa);
+std::vector<int> numa_nodes();
+long huge_page_bytes();
+#endif
@@ -3,8 +3,132 @@
 #include <iostream>
 #include <unordered_map>
 #include <algorithm>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cmath>
 #include "query_corpora.h"
+#include "suffix_array.h"
 #include <span>
+thread_local QueryTrace *active_trace = nullptr;
+TraceScope::TraceScope(QueryTrace &trace) : previous(active_trace){
+    active_trace = &trace;
+}
+TraceScope::~TraceScope(){
+    active_trace = previous;
+}
+thread_local QueryBudget *active_budget = nullptr;
+thread_local long budget_work = 0;
+BudgetScope::BudgetScope(QueryBudget &budget) : previous(active_budget){
+    budget.start = std::chrono::steady_clock::now();
+    budget.allocated = 0;
+    budget_work = 0;
+    active_budget = &budget;
+}
+BudgetScope::~BudgetScope(){
+    active_budget = previous;
+}
+WorkerBudgetScope::WorkerBudgetScope(QueryBudget *budget) : previous(active_budget){
+    budget_work = 0;
+    active_budget = budget;
+}
+WorkerBudgetScope::~WorkerBudgetScope(){
+    active_budget = previous;
+}
+//Throws if the active query was cancelled or ran out of time
+void check_budget(){
+    QueryBudget &b = *active_budget;
+    budget_work = 0;
+    if(b.cancelled.load(std::memory_order_relaxed)){
+        throw QueryAborted("Query cancelled");
+    }
+    std::chrono::duration<double, std::milli> d = std::chrono::steady_clock::now() - b.start;
+    if(b.time_ms > 0 && d.count() > b.time_ms){
+        throw QueryAborted("Query went over its time budget of " + std::to_string((long)b.time_ms) + " ms");
+    }
+}
+void exceed_memory(long bytes){
+    throw QueryAborted("Query went over its memory budget of " + std::to_string(active_budget->memory_bytes >> 20) + " MB allocating "
+                       + std::to_string(bytes >> 20) + " MB");
+}
+//Output size and bytes allocated for the output of an operator
+long trace_size(const MatchSet &m){
+    return get_size(m);
+}
+long trace_bytes(const MatchSet &m){
+    if(const ExplicitSet *e = std::get_if<ExplicitSet>(&m.set)){
+        return e->elems.capacity() * sizeof(Position);
+    }
+    return 0;
+}
+long trace_size(const std::vector<Match> &m){
+    return m.size();
+}
+long trace_bytes(const std::vector<Match> &m){
+    return m.capacity() * sizeof(Match);
+}
+long trace_size(const std::vector<Position> &m){
+    return m.size();
+}
+long trace_bytes(const std::vector<Position> &m){
+    return m.capacity() * sizeof(Position);
+}
+//Runs an operator and records it if a trace is active, when no trace is active this is only a null check
+template <typename F>
+auto traced(const char *op, long left, long right, F f){
+    if(!active_trace){
+        return f();
+    }
+    active_trace->pending = TraceEvent{op, "", "", left, right, 0, 0, 0};
+    auto start = std::chrono::steady_clock::now();
+    auto result = f();
+    std::chrono::duration<double, std::milli> d = std::chrono::steady_clock::now() - start;
+    TraceEvent e = active_trace->pending;
+    e.output = trace_size(result);
+    e.bytes = trace_bytes(result);
+    e.ms = d.count();
+    active_trace->events.push_back(e);
+    return result;
+}
+//Prints the recorded operators as a table
+void print_trace(std::ostream &out, const QueryTrace &trace){
+    char line[256];
+    double total = 0;
+    std::snprintf(line, sizeof(line), "%-12s %-14s %10s %10s %10s %10s %12s  %s\n", "op", "algorithm", "left", "right", "output", "ms", "bytes", "detail");
+    out << line;
+    for(const TraceEvent &e: trace.events){
+        std::snprintf(line, sizeof(line), "%-12s %-14s %10ld %10ld %10ld %10.3f %12ld  %s\n", e.op.c_str(), e.algorithm.c_str(),
+                      e.left, e.right, e.output, e.ms, e.bytes, e.detail.c_str());
+        out << line;
+        total += e.ms;
+    }
+    std::snprintf(line, sizeof(line), "total %.3f ms\n", total);
+    out << line;
+}
+
+//Sorted positions in Eytzinger order, keys are placed by an in-order walk of the implicit tree
+EytzingerTree eytzinger_layout(std::span<const Position> sorted){
+    EytzingerTree tree(sorted.size() + 1);
+    tree[0] = EytzingerNode{0, (Position)sorted.size()};
+    Position next = 0;
+    auto fill = [&tree, &sorted, &next](auto &&fill, size_t k) -> void{
+        if(k < tree.size()){
+            fill(fill, 2 * k);
+            tree[k] = EytzingerNode{sorted[next], next};
+            next++;
+            fill(fill, 2 * k + 1);
+        }
+    };
+    fill(fill, 1);
+    return tree;
+}
+//Eytzinger layout of the sentence starts, only built when sentence_of searches it
+void build_sentence_tree([[maybe_unused]] Corpus &corpus){
+#ifdef CORPUS_EYTZINGER
+    corpus.sentence_tree = eytzinger_layout(corpus.sentences);
+#endif
+}
+
 //Load corpus into a corpus object from a file
 Corpus load_corpus(const std::string &filename){
     Corpus corpus;
@@ -12,14 +136,20 @@ Corpus load_corpus(const std::string &filename){
     if (!f) { 
         std::cerr << "Unable to open file" << std::endl;
     }
+    load_tokens(f, corpus, corpus);
+    return corpus;
+}
+
+//Reads tokens and sentence boundaries from a stream into target, strings are looked up and added in dictionary
+void load_tokens(std::istream &f, Corpus &dictionary, Corpus &target){
     std::string l;
     bool skip = true;
-    int pos = 0;
-    corpus.sentences.push_back(pos);
+    Position pos = 0;
+    target.sentences.push_back(pos);
     while(std::getline(f,l)){
         //We've reached the end of a sentence, so we add the sentence to the corpus
         if(l.empty()){
-            corpus.sentences.push_back(pos);
+            target.sentences.push_back(pos);
             continue;
         //Skip comment lines
         } else if(l[0] == '#'){
@@ -36,75 +166,266 @@ Corpus load_corpus(const std::string &filename){
         std::getline(l_stream, t_c5, '\t');
         std::getline(l_stream, t_lemma, '\t');
         std::getline(l_stream, t_pos, '\t');
-        Token t = generate_token(corpus, t_word, t_c5, t_lemma, t_pos);
-        corpus.tokens.push_back(t);
+        Token t = generate_token(dictionary, t_word, t_c5, t_lemma, t_pos);
+        target.tokens.push_back(t);
         pos++;
     }
-    corpus.sentences.push_back(corpus.tokens.size());
-    return corpus;
+    //A blank last line already closed the last sentence, another boundary would add an empty one
+    if(target.sentences.back() != (Position)target.tokens.size()){
+        target.sentences.push_back(target.tokens.size());
+    }
 }
 
 //Builds an index for an attribute
 Index build_index(const std::vector<Token> &tokens, uint32_t Token::* attribute){
-    Index index(tokens.size());
-    for(int i = 0; i < (int)tokens.size() - 1; i++){
-        index[i] = i;
+    uint32_t num_keys = 0;
+    for(const Token &t: tokens){
+        num_keys = std::max(num_keys, t.*attribute + 1);
     }
-    std::stable_sort(index.begin(), index.end(), [attribute, &tokens](int a, int b) {
-        return tokens[a].*attribute < tokens[b].*attribute;
-    });
+    Index index;
+    build_indices(tokens, num_keys, {attribute}, {&index});
     return index;
 }
 
 //Builds indices for the all atributes
 void build_indices(Corpus &corpus){
-    corpus.lemma_index = build_index(corpus.tokens, &Token::lemma);
-    corpus.c5_index = build_index(corpus.tokens, &Token::c5);
-    corpus.word_index = build_index(corpus.tokens, &Token::word);
-    corpus.pos_index = build_index(corpus.tokens, &Token::pos);
+    build_indices(corpus, corpus.index2string.size());
+}
+void build_indices(Corpus &corpus, uint32_t num_keys){
+    std::vector<uint32_t Token::*> attributes = {&Token::lemma, &Token::c5, &Token::word, &Token::pos, &Token::folded_word, &Token::folded_lemma};
+    build_indices(corpus.tokens, num_keys, attributes,
+        {&corpus.lemma_index, &corpus.c5_index, &corpus.word_index, &corpus.pos_index, &corpus.folded_word_index, &corpus.folded_lemma_index});
+    build_sentence_indices(corpus, num_keys, attributes,
+        {&corpus.lemma_index, &corpus.c5_index, &corpus.word_index, &corpus.pos_index, &corpus.folded_word_index, &corpus.folded_lemma_index},
+        {&corpus.lemma_sentences, &corpus.c5_sentences, &corpus.word_sentences, &corpus.pos_sentences, &corpus.folded_word_sentences, &corpus.folded_lemma_sentences});
+    build_byte_columns(corpus);
+    build_sentence_tree(corpus);
+}
+
+//Codes every token of an attribute in order of first occurrence, gives up once there are more than 255 values
+ByteColumn build_byte_column(const std::vector<Token> &tokens, uint32_t Token::* attribute){
+    ByteColumn column;
+    std::vector<int16_t> code;
+    column.codes.resize(tokens.size());
+    for(size_t i = 0; i < tokens.size(); i++){
+        uint32_t v = tokens[i].*attribute;
+        if(v >= code.size()){
+            code.resize(v + 1, -1);
+        }
+        if(code[v] < 0){
+            if(column.values.size() == 255){
+                return ByteColumn();
+            }
+            code[v] = column.values.size();
+            column.values.push_back(v);
+        }
+        column.codes[i] = code[v];
+    }
+    return column;
+}
+void build_byte_columns(Corpus &corpus){
+    corpus.word_column = build_byte_column(corpus.tokens, &Token::word);
+    corpus.c5_column = build_byte_column(corpus.tokens, &Token::c5);
+    corpus.lemma_column = build_byte_column(corpus.tokens, &Token::lemma);
+    corpus.pos_column = build_byte_column(corpus.tokens, &Token::pos);
+}
+//The byte column of an attribute, empty if it has too many values. Folded attributes have none.
+const ByteColumn &byte_column(const Corpus &corpus, const std::string &attribute){
+    static const ByteColumn none;
+    if(attribute == "word"){
+        return corpus.word_column;
+    } else if(attribute == "c5"){
+        return corpus.c5_column;
+    } else if(attribute == "lemma"){
+        return corpus.lemma_column;
+    } else if(attribute == "pos"){
+        return corpus.pos_column;
+    }
+    return none;
+}
+
+//Builds the sentence index of each attribute from its token index, in its own thread. The positions
+//of a value are sorted, so mapping them to sentences gives sorted sentence ids where repeats are
+//next to each other and one pass over the token index is enough.
+void build_sentence_indices(const Corpus &corpus, uint32_t num_keys, const std::vector<uint32_t Token::*> &attributes, const std::vector<const Index*> &token_indices, const std::vector<SentenceIndex*> &indices){
+    Position n = corpus.tokens.size();
+    std::vector<Position> sentence_of(n);
+    for(Position s = 0; s + 1 < (Position)corpus.sentences.size(); s++){
+        std::fill(sentence_of.begin() + corpus.sentences[s], sentence_of.begin() + corpus.sentences[s + 1], s);
+    }
+    auto build = [&](int a){
+        const Index &index = *token_indices[a];
+        SentenceIndex &sentences = *indices[a];
+        //Counting the tokens of every value gives where its positions end in the token index
+        std::vector<Position> counts(num_keys, 0);
+        for(const Token &t: corpus.tokens){
+            counts[t.*attributes[a]]++;
+        }
+        sentences.offsets.assign(num_keys + 1, 0);
+        sentences.ids.resize(n);
+        Position i = 0;
+        Position k = 0;
+        for(uint32_t v = 0; v < num_keys; v++){
+            Position end = i + counts[v];
+            //Every id is written and only kept if it differs from the one before
+            for(Position last = -1; i < end; i++){
+                Position s = sentence_of[index[i]];
+                sentences.ids[k] = s;
+                k += s != last;
+                last = s;
+            }
+            sentences.offsets[v + 1] = k;
+        }
+        sentences.ids.resize(k);
+        sentences.ids.shrink_to_fit();
+    };
+    //Small corpora are not worth starting threads for
+    if(build_threads(n, num_keys) == 1){
+        for(int a = 0; a < (int)attributes.size(); a++){
+            build(a);
+        }
+        return;
+    }
+    std::vector<std::thread> threads;
+    for(int a = 1; a < (int)attributes.size(); a++){
+        threads.emplace_back(build, a);
+    }
+    build(0);
+    for(std::thread &t: threads){
+        t.join();
+    }
+}
+
+//Number of threads used for building indices, small corpora are not worth starting threads for
+//and every thread needs its own counts, so each should have more tokens than there are keys
+int build_threads(size_t num_tokens, uint32_t num_keys){
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t per_thread = std::max<size_t>(65536, num_keys);
+    return std::clamp((int)(num_tokens / per_thread), 1, threads);
+}
+
+//Builds indices for several attributes at once with a counting sort. Ids are small dense integers,
+//so instead of a comparison sort per attribute we make two passes over the tokens: one counting every
+//attribute value per chunk and one placing every position. Chunks are handled in parallel and are
+//placed in corpus order, so each index is sorted by value and then by position.
+void build_indices(const std::vector<Token> &tokens, uint32_t num_keys, const std::vector<uint32_t Token::*> &attributes, const std::vector<Index*> &indices){
+    Position n = tokens.size();
+    int num_attributes = attributes.size();
+    int num_chunks = build_threads(n, num_keys);
+    Position chunk_size = (n + num_chunks - 1) / num_chunks;
+    //counts[chunk * num_attributes + attribute][key], turned into write offsets after counting
+    std::vector<std::vector<Position>> counts(num_chunks * num_attributes, std::vector<Position>(num_keys, 0));
+    auto run = [](int count, auto f){
+        std::vector<std::thread> threads;
+        for(int i = 1; i < count; i++){
+            threads.emplace_back(f, i);
+        }
+        f(0);
+        for(std::thread &t: threads){
+            t.join();
+        }
+    };
+    //First pass, count values in each chunk
+    run(num_chunks, [&](int chunk){
+        Position first = chunk * chunk_size;
+        Position last = std::min(n, first + chunk_size);
+        for(Position i = first; i < last; i++){
+            for(int a = 0; a < num_attributes; a++){
+                counts[chunk * num_attributes + a][tokens[i].*attributes[a]]++;
+            }
+        }
+    });
+    //Turn counts into offsets, each attribute is done in parallel
+    for(Index *index: indices){
+        index->resize(n);
+    }
+    run(num_attributes, [&](int a){
+        Position offset = 0;
+        for(uint32_t key = 0; key < num_keys; key++){
+            for(int chunk = 0; chunk < num_chunks; chunk++){
+                Position count = counts[chunk * num_attributes + a][key];
+                counts[chunk * num_attributes + a][key] = offset;
+                offset += count;
+            }
+        }
+    });
+    //Second pass, place every position at its offset
+    run(num_chunks, [&](int chunk){
+        Position first = chunk * chunk_size;
+        Position last = std::min(n, first + chunk_size);
+        for(Position i = first; i < last; i++){
+            for(int a = 0; a < num_attributes; a++){
+                (*indices[a])[counts[chunk * num_attributes + a][tokens[i].*attributes[a]]++] = i;
+            }
+        }
+    });
 }
 
 //Generates a token
 Token generate_token(Corpus &corpus, std::string t_word, std::string t_c5, std::string t_lemma, std::string t_pos){
     Token t;
-    auto index = corpus.string2index.find(t_word);
+    t.word = intern(corpus, t_word);
+    t.c5 = intern(corpus, t_c5);
+    t.lemma = intern(corpus, t_lemma);
+    t.pos = intern(corpus, t_pos);
+    t.folded_word = corpus.folded[t.word];
+    t.folded_lemma = corpus.folded[t.lemma];
+    return t;
+}
+//Id of a string in the dictionary, a new string is added together with its folded form
+uint32_t intern(Corpus &corpus, const std::string &s){
+    auto index = corpus.string2index.find(s);
     if (index != corpus.string2index.end()){
-        t.word = index->second;
-    } else{
-    
-        int i = corpus.index2string.size();
-        corpus.index2string.push_back(t_word);
-        corpus.string2index.insert({t_word, i});
-        t.word = i;
+        return index->second;
     }
-    index = corpus.string2index.find(t_c5);
-    if (index != corpus.string2index.end()){
-        t.c5 = index->second;
-    } else{
-        int i = corpus.index2string.size();
-        corpus.index2string.push_back(t_c5);
-        corpus.string2index.insert({t_c5, i});
-        t.c5 = i;
+    uint32_t i = corpus.index2string.size();
+    corpus.index2string.push_back(s);
+    corpus.string2index.insert({s, i});
+    corpus.folded.push_back(i);
+    std::string f = fold(s);
+    if(f != s){
+        uint32_t folded = intern(corpus, f);
+        corpus.folded[i] = folded;
     }
-    index = corpus.string2index.find(t_lemma);
-    if (index != corpus.string2index.end()){
-        t.lemma = index->second;
-    } else{
-        int i = corpus.index2string.size();
-        corpus.index2string.push_back(t_lemma);
-        corpus.string2index.insert({t_lemma, i});
-        t.lemma = i;
-    }
-    index = corpus.string2index.find(t_pos);
-    if (index != corpus.string2index.end()){
-        t.pos = index->second;
-    } else{
-        int i = corpus.index2string.size();
-        corpus.index2string.push_back(t_pos);
-        corpus.string2index.insert({t_pos, i});
-        t.pos = i;
+    return i;
+}
+//Base letters of U+00C0 to U+017F in order, '2' marks letters that fold to two letters and '*' signs that are kept
+const char latin_letters[] = "aaaaaa2ceeeeiiiidnooooo*ouuuuy22aaaaaa2ceeeeiiiidnooooo*ouuuuy2y"
+                             "aaaaaaccccccccddddeeeeeeeeeegggggggghhhhiiiiiiiiii22jjkkkllllllllllnnnnnnnnnoooooo22rrrrrrssssssssttttttuuuuuuuuuuuuwwyyyzzzzzzs";
+//Folds a string for case and diacritic insensitive matching: ASCII letters are lowercased and Latin
+//letters from U+00C0 to U+017F lose case and diacritics, everything else is kept as it is
+std::string fold(const std::string &s){
+    std::string folded;
+    folded.reserve(s.size());
+    for(size_t i = 0; i < s.size(); i++){
+        unsigned char c = s[i];
+        if(c >= 'A' && c <= 'Z'){
+            folded += (char)(c - 'A' + 'a');
+            continue;
+        }
+        //These letters are two byte UTF-8 sequences starting with 0xC3 to 0xC5
+        if(c >= 0xC3 && c <= 0xC5 && i + 1 < s.size() && ((unsigned char)s[i + 1] & 0xC0) == 0x80){
+            unsigned code_point = ((c & 0x1F) << 6) | ((unsigned char)s[i + 1] & 0x3F);
+            char base = latin_letters[code_point - 0xC0];
+            if(base == '2'){
+                switch(code_point){
+                    case 0xC6: case 0xE6: folded += "ae"; break;
+                    case 0xDE: case 0xFE: folded += "th"; break;
+                    case 0xDF: folded += "ss"; break;
+                    case 0x132: case 0x133: folded += "ij"; break;
+                    default: folded += "oe";
+                }
+                i++;
+                continue;
+            } else if(base != '*'){
+                folded += base;
+                i++;
+                continue;
+            }
+        }
+        folded += (char)c;
     }
-    return t;
+    return folded;
 }
 
 //Parses a query from a string
@@ -135,17 +456,30 @@ Query parse_query(const std::string &text, const Corpus &corpus){
                 }    
                 if(text[i] == '!'){
                     l.is_equality = false;
-                    i+=3;
+                    i+=2;
                 } else{
                     l.is_equality = true;
-                    i+=2;
+                    i+=1;
                 }
+                //An i before the value matches it case and diacritic insensitively through the folded attribute
+                bool folded = text[i] == 'i';
+                if(folded){
+                    if(l.attribute != "word" && l.attribute != "lemma"){
+                        throw std::invalid_argument("Only word and lemma can be matched insensitively");
+                    }
+                    l.attribute = "folded_" + l.attribute;
+                    i++;
+                }
+                i++;
                 s.clear();
                 //loop through value
                 while(text[i]!= '"'){
                     s += text[i];
                     i++;
                 }
+                if(folded){
+                    s = fold(s);
+                }
                 auto index = corpus.string2index.find(s);
                 if (index != corpus.string2index.end()){
                     l.value = index->second;
@@ -182,63 +516,177 @@ Query parse_query(const std::string &text, const Corpus &corpus){
 
 //Checks if an attribute is valid
 bool attribute_is_valid(std::string &attr){
-    return (attr == "word" || attr == "lemma" || attr == "pos" || attr == "c5");
+    return (attr == "word" || attr == "lemma" || attr == "pos" || attr == "c5" || attr == "folded_word" || attr == "folded_lemma");
 }
-//Looks through the index of the submitted value and finds all instances of value in it.
+//Returns the token member for an attribute
+uint32_t Token::* attribute_member(const std::string &attribute){
+    if(attribute == "word"){
+        return &Token::word;
+    } else if(attribute == "lemma"){
+        return &Token::lemma;
+    } else if(attribute == "pos"){
+        return &Token::pos;
+    } else if(attribute == "c5"){
+        return &Token::c5;
+    } else if(attribute == "folded_word"){
+        return &Token::folded_word;
+    } else if(attribute == "folded_lemma"){
+        return &Token::folded_lemma;
+    }
+    throw std::invalid_argument("Attribute " + attribute + " does not exist");
+}
+//Looks through the index of the submitted value and finds all instances of value in it. Attributes
+//with a packed index have no token index to look through, see decode_postings.
 IndexSet index_lookup(const Corpus &corpus, const std::string &attribute, uint32_t value){
-    auto &tokens = corpus.tokens;
+    if(packed_index(corpus, attribute)){
+        throw std::invalid_argument("Attribute " + attribute + " has no plain index");
+    }
     if(attribute == "lemma"){
-        auto start = std::find_if(corpus.lemma_index.begin(), corpus.lemma_index.end(), [tokens, value](int a) {
-            return tokens[a].lemma == value;});
-        auto end =  std::find_if(start, corpus.lemma_index.end(), [tokens, value](int a) {
-            return tokens[a].lemma != value;});
-        size_t startpos =  std::distance(corpus.lemma_index.begin(), start);
-        size_t endpos =  std::distance(corpus.lemma_index.begin(), end);
-        IndexSet s;
-        s.elems = std::span<const int>(corpus.lemma_index.begin() + startpos, endpos-startpos);
-        return s;
+        return index_lookup(corpus.lemma_index, corpus.tokens, &Token::lemma, value);
     }else if(attribute == "c5"){
-        auto start = std::find_if(corpus.c5_index.begin(), corpus.c5_index.end(), [tokens, value](int a) {
-            return tokens[a].c5 == value;});
-        auto end =  std::find_if(start, corpus.c5_index.end(), [tokens, value](int a) {
-            return tokens[a].c5 != value;});
-        size_t startpos =  std::distance(corpus.c5_index.begin(), start);
-        size_t endpos =  std::distance(corpus.c5_index.begin(), end);
-
-        IndexSet s;
-        s.elems = std::span<const int>(corpus.c5_index.begin() + startpos, endpos-startpos);
-        return s;
+        return index_lookup(corpus.c5_index, corpus.tokens, &Token::c5, value);
     } else if(attribute == "word"){
-        auto start = std::find_if(corpus.word_index.begin(), corpus.word_index.end(), [tokens, value](int a) {
-            return tokens[a].word == value;});
-        auto end =  std::find_if(start, corpus.word_index.end(), [tokens, value](int a) {
-            return tokens[a].word != value;});
-        size_t startpos =  std::distance(corpus.word_index.begin(), start);
-        size_t endpos =  std::distance(corpus.word_index.begin(), end);
-
-        IndexSet s;
-        s.elems = std::span<const int>(corpus.word_index.begin() + startpos, endpos-startpos);
-        return s;
+        return index_lookup(corpus.word_index, corpus.tokens, &Token::word, value);
+    } else if(attribute == "folded_word"){
+        return index_lookup(corpus.folded_word_index, corpus.tokens, &Token::folded_word, value);
+    } else if(attribute == "folded_lemma"){
+        return index_lookup(corpus.folded_lemma_index, corpus.tokens, &Token::folded_lemma, value);
     } else{
-        auto start = std::find_if(corpus.pos_index.begin(), corpus.pos_index.end(), [tokens, value](int a) {
-            return tokens[a].pos == value;});
-        auto end =  std::find_if(start, corpus.pos_index.end(), [tokens, value](int a) {
-            return tokens[a].pos != value;});
-        size_t startpos =  std::distance(corpus.pos_index.begin(), start);
-        size_t endpos =  std::distance(corpus.pos_index.begin(), end);
-
-        IndexSet s;
-        s.elems = std::span<const int>(corpus.pos_index.begin() + startpos, endpos-startpos);
-        return s;
+        return index_lookup(corpus.pos_index, corpus.tokens, &Token::pos, value);
+    }
+}
+//The index is sorted by value, so the range holding value is found with two binary searches
+IndexSet index_lookup(const Index &index, const std::vector<Token> &tokens, uint32_t Token::* attribute, uint32_t value){
+    auto start = std::partition_point(index.begin(), index.end(), [&tokens, attribute, value](Position a) {
+        return tokens[a].*attribute < value;});
+    auto end = std::partition_point(start, index.end(), [&tokens, attribute, value](Position a) {
+        return tokens[a].*attribute <= value;});
+    IndexSet s;
+    s.elems = std::span<const Position>(start, end);
+    s.shift = 0;
+    return s;
+}
+//The packed index of an attribute, null if its index is plain
+const PackedIndex *packed_index(const Corpus &corpus, const std::string &attribute){
+    if(corpus.packed.empty()){
+        return nullptr;
+    }
+    auto packed = corpus.packed.find(attribute);
+    return packed == corpus.packed.end() ? nullptr : &packed->second;
+}
+//True if the posting lists of an attribute can be looked up instead of scanned for
+bool is_indexed(const Corpus &corpus, const std::string &attribute){
+    const PackedIndex *packed = packed_index(corpus, attribute);
+    return !packed || packed->kind != IndexKind::none;
+}
+//Number of tokens that have a value, whichever way the attribute is indexed
+Position posting_size(const Corpus &corpus, const std::string &attribute, uint32_t value){
+    const PackedIndex *packed = packed_index(corpus, attribute);
+    if(!packed){
+        return index_lookup(corpus, attribute, value).elems.size();
+    }
+    auto found = std::lower_bound(packed->values.begin(), packed->values.end(), value);
+    return found != packed->values.end() && *found == value ? packed->counts[found - packed->values.begin()] : 0;
+}
+//Positions of the tokens that have a value, decoded from a packed index or, for an attribute without one,
+//found by scanning its byte column or the tokens. The positions are a new list charged to the budget.
+std::vector<Position> decode_postings(const Corpus &corpus, const std::string &attribute, const PackedIndex &packed, uint32_t value){
+    std::vector<Position> positions;
+    auto found = std::lower_bound(packed.values.begin(), packed.values.end(), value);
+    if(found == packed.values.end() || *found != value){
+        return positions;
+    }
+    size_t i = found - packed.values.begin();
+    charge_budget(packed.counts[i] * sizeof(Position));
+    positions.reserve(packed.counts[i]);
+    if(packed.kind == IndexKind::compressed){
+        const uint8_t *p = packed.bytes.data() + packed.offsets[i];
+        const uint8_t *end = packed.bytes.data() + packed.offsets[i + 1];
+        Position at = 0;
+        while(p < end){
+            uint64_t gap = 0;
+            for(int bits = 0; ; bits += 7){
+                gap |= (uint64_t)(*p & 0x7F) << bits;
+                if(!(*p++ & 0x80)){
+                    break;
+                }
+            }
+            at += gap;
+            positions.push_back(at);
+        }
+    } else if(packed.kind == IndexKind::bitmap){
+        const uint64_t *words = packed.bits.data() + i * packed.words_per_value;
+        for(size_t w = 0; w < packed.words_per_value; w++){
+            for(uint64_t bits = words[w]; bits; bits &= bits - 1){
+                positions.push_back(w * 64 + __builtin_ctzll(bits));
+            }
+            poll_budget(64);
+        }
+    } else{
+        const ByteColumn &column = byte_column(corpus, attribute);
+        uint8_t code = std::find(column.values.begin(), column.values.end(), value) - column.values.begin();
+        uint32_t Token::* member = attribute_member(attribute);
+        Position n = corpus.tokens.size();
+        for(Position from = 0; from < n; from += budget_poll_work){
+            Position to = std::min<Position>(n, from + budget_poll_work);
+            if(!column.codes.empty()){
+                for(Position t = from; t < to; t++){
+                    if(column.codes[t] == code){
+                        positions.push_back(t);
+                    }
+                }
+            } else{
+                for(Position t = from; t < to; t++){
+                    if(corpus.tokens[t].*member == value){
+                        positions.push_back(t);
+                    }
+                }
+            }
+            poll_budget(to - from);
+        }
+    }
+    return positions;
+}
+//Sentences a value of an attribute occurs in
+std::span<const Position> sentence_lookup(const Corpus &corpus, const std::string &attribute, uint32_t value){
+    const SentenceIndex *index = &corpus.pos_sentences;
+    if(attribute == "word"){
+        index = &corpus.word_sentences;
+    } else if(attribute == "c5"){
+        index = &corpus.c5_sentences;
+    } else if(attribute == "lemma"){
+        index = &corpus.lemma_sentences;
+    } else if(attribute == "folded_word"){
+        index = &corpus.folded_word_sentences;
+    } else if(attribute == "folded_lemma"){
+        index = &corpus.folded_lemma_sentences;
+    }
+    if(value + 1 >= index->offsets.size()){
+        return {};
+    }
+    return std::span<const Position>(index->ids).subspan(index->offsets[value], index->offsets[value + 1] - index->offsets[value]);
+}
+//Looks up every literal in the queries once, so queries sharing literals share the posting lists
+LookupCache resolve_literals(const Corpus &corpus, const std::vector<Query> &queries){
+    LookupCache cache;
+    for(const Query &q: queries){
+        for(const Clause &c: q){
+            for(const Literal &l: c){
+                auto key = std::make_pair(l.attribute, l.value);
+                if(cache.find(key) == cache.end() && !packed_index(corpus, l.attribute)){
+                    cache.insert({key, index_lookup(corpus, l.attribute, l.value)});
+                }
+            }
+        }
     }
+    return cache;
 }
 //Match function from older version
 std::vector<Match> match_single(Corpus &corpus, const std::string &attr, const std::string &value){
     std::vector<Match> matches;
     IndexSet s = index_lookup(corpus, attr, corpus.string2index.find(value)->second);
-    for(const int &t:s.elems){
-        auto sentence = std::upper_bound(corpus.sentences.begin(), corpus.sentences.end(), t);
-        int sentence_index = std::distance(corpus.sentences.begin(), sentence) - 1;
+    for(const Position &t:s.elems){
+        Position sentence_index = sentence_of(corpus, t);
         Match m;
         m.sentence = sentence_index;
         m.len = 1;
@@ -247,17 +695,88 @@ std::vector<Match> match_single(Corpus &corpus, const std::string &attr, const s
     }
     return matches;
 }
-//Creates a match_set from a literal
-MatchSet match_set(const Corpus &corpus, const Literal &literal, int shift){
+//A literal as it is written in a query
+std::string describe(const Corpus &corpus, const Literal &literal){
+    const std::string &value = literal.value < corpus.index2string.size() ? corpus.index2string[literal.value] : "";
+    return literal.attribute + (literal.is_equality ? "=\"" : "!=\"") + value + "\"";
+}
+//Creates a match_set from a literal. Literals on a packed index get their decoded positions as an
+//explicit set, moved to where a match starts.
+MatchSet match_set(const Corpus &corpus, const Literal &literal, int shift, const LookupCache *cache){
     MatchSet m;
     m.complement = !literal.is_equality;
-    IndexSet s = index_lookup(corpus, literal.attribute, literal.value);
+    if(const PackedIndex *packed = packed_index(corpus, literal.attribute)){
+        m.set = traced("lookup", 0, 0, [&](){
+            const char *algorithm[] = {"binary_search", "decode_varint", "decode_bitmap", "scan"};
+            trace_algorithm(algorithm[(int)packed->kind]);
+            if(active_trace){
+                active_trace->pending.detail = describe(corpus, literal);
+            }
+            ExplicitSet s{decode_postings(corpus, literal.attribute, *packed, literal.value)};
+            //Positions before the clause offset can not start a match
+            s.elems.erase(s.elems.begin(), std::lower_bound(s.elems.begin(), s.elems.end(), (Position)shift));
+            for(Position &x: s.elems){
+                x -= shift;
+            }
+            return MatchSet{s, false};
+        }).set;
+        return m;
+    }
+    MatchSet looked_up = traced("lookup", 0, 0, [&](){
+        MatchSet l;
+        auto cached = cache ? cache->find(std::make_pair(literal.attribute, literal.value)) : LookupCache::const_iterator();
+        if(cache && cached != cache->end()){
+            l.set = cached->second;
+            trace_algorithm("cached");
+        } else{
+            l.set = index_lookup(corpus, literal.attribute, literal.value);
+            trace_algorithm("binary_search");
+        }
+        if(active_trace){
+            active_trace->pending.detail = describe(corpus, literal);
+        }
+        return l;
+    });
+    IndexSet s = std::get<IndexSet>(looked_up.set);
     s.shift = shift;
     m.set = s;
     return m;
 }
-//Creates match sets for all literals in the clause and adds it to the matchset vector
-void match_set(const Corpus &corpus, const Clause &clause, int shift, std::vector<MatchSet> &sets){
+//Views whose literals are all in a clause, smallest first and each covering a literal no earlier view
+//covers. covered is set for the literals of the clause the views stand in for.
+std::vector<const MaterializedView*> covering_views(const Corpus &corpus, const Clause &clause, std::vector<bool> &covered){
+    covered.assign(clause.size(), false);
+    std::vector<const MaterializedView*> views;
+    if(corpus.views.empty() || clause.size() < 2){
+        return views;
+    }
+    auto find = [&clause](const Literal &l){
+        return std::find_if(clause.begin(), clause.end(), [&l](const Literal &c){
+            return c.attribute == l.attribute && c.value == l.value && c.is_equality == l.is_equality;
+        }) - clause.begin();
+    };
+    std::vector<const MaterializedView*> candidates;
+    for(const MaterializedView &view: corpus.views){
+        if(std::all_of(view.literals.begin(), view.literals.end(), [&](const Literal &l){ return find(l) < (long)clause.size(); })){
+            candidates.push_back(&view);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(), [](const MaterializedView *a, const MaterializedView *b){ return a->positions.size() < b->positions.size(); });
+    for(const MaterializedView *view: candidates){
+        bool adds = false;
+        for(const Literal &l: view->literals){
+            adds = adds || !covered[find(l)];
+            covered[find(l)] = true;
+        }
+        if(adds){
+            views.push_back(view);
+        }
+    }
+    return views;
+}
+//Creates match sets for all literals in the clause and adds it to the matchset vector. Literals that
+//are covered by materialized views are read from the views.
+void match_set(const Corpus &corpus, const Clause &clause, int shift, std::vector<MatchSet> &sets, const LookupCache *cache){
     if(clause.empty()){
         DenseSet d;
         d.first = 0;
@@ -267,12 +786,28 @@ void match_set(const Corpus &corpus, const Clause &clause, int shift, std::vecto
         m.set = d;
         sets.push_back(m);
     }
+    std::vector<bool> covered;
+    for(const MaterializedView *view: covering_views(corpus, clause, covered)){
+        sets.push_back(traced("lookup", 0, 0, [&](){
+            trace_algorithm("view");
+            if(active_trace){
+                std::string &detail = active_trace->pending.detail;
+                for(const Literal &l: view->literals){
+                    detail += detail.empty() ? "" : " ";
+                    detail += describe(corpus, l);
+                }
+            }
+            return MatchSet{IndexSet{view->positions, shift}, false};
+        }));
+    }
     for(int i = 0; i < (int)clause.size(); i++){
-        sets.push_back(match_set(corpus, clause[i], shift));
+        if(!covered[i]){
+            sets.push_back(match_set(corpus, clause[i], shift, cache));
+        }
     }
 }
 //Returns a matchset from a query
-MatchSet match_set(const Corpus &corpus, const Query &query){
+MatchSet match_set(const Corpus &corpus, const Query &query, const LookupCache *cache){
     //Return empty query
     if(query.empty()){
         DenseSet d;
@@ -283,10 +818,29 @@ MatchSet match_set(const Corpus &corpus, const Query &query){
         m.set = d;
         return m;
     }
+    ExplicitSet phrase;
+    if(use_suffix_array(corpus, query) && locate_phrase(corpus, query, phrase.elems)){
+        return MatchSet{phrase, false};
+    }
     //Create matchsets for everything in the query
     std::vector<MatchSet> sets;
     for(int i = 0; i < (int)query.size(); i++){
-        match_set(corpus, query[i], i, sets);
+        match_set(corpus, query[i], i, sets, cache);
+    }
+    //Posting lists of positive literals are intersected in one pass instead of one pair at a time
+    std::vector<IndexSet> positive;
+    for(const MatchSet &m: sets){
+        if(!m.complement && std::holds_alternative<IndexSet>(m.set)){
+            positive.push_back(std::get<IndexSet>(m.set));
+        }
+    }
+    if((int)positive.size() >= kway_min_sets){
+        std::erase_if(sets, [](const MatchSet &m){ return !m.complement && std::holds_alternative<IndexSet>(m.set); });
+        long smallest = std::min_element(positive.begin(), positive.end(), [](const IndexSet &a, const IndexSet &b){ return a.elems.size() < b.elems.size(); })->elems.size();
+        sets.push_back(traced("intersection", smallest, positive.size(), [&positive](){
+            trace_algorithm("kway");
+            return MatchSet{kway_intersection(positive), false};
+        }));
     }
     //Pick out all densesets
     std::vector<MatchSet> densesets;
@@ -329,78 +883,330 @@ MatchSet match_set(const Corpus &corpus, const Query &query){
         DenseSet d;
         d.first = 0;
         d.last = corpus.tokens.size() - 1;
-        intersect.set = std::visit([&d](auto&& arg2){ return difference(d, arg2); }, intersect.set);
-        intersect.complement = false;
+        intersect = traced("complement", get_size(d), get_size(intersect), [&d, &intersect](){
+            MatchSet m;
+            m.set = std::visit([&d](auto&& arg2){ return difference(d, arg2); }, intersect.set);
+            m.complement = false;
+            return m;
+        });
     }
     return intersect;
 }
+//Sentences that have a token matching every clause of the query, in any order and anywhere in the
+//sentence. Clauses of one equality are read from the sentence index, other clauses are matched as
+//tokens first. The sentence lists are then intersected like posting lists.
+std::vector<Position> match_sentences(const Corpus &corpus, const Query &query){
+    Position num_sentences = (Position)corpus.sentences.size() - 1;
+    std::vector<IndexSet> lists;
+    std::vector<std::vector<Position>> matched(query.size());
+    for(int i = 0; i < (int)query.size(); i++){
+        const Clause &clause = query[i];
+        if(clause.empty()){
+            continue;
+        }
+        if(clause.size() == 1 && clause[0].is_equality){
+            lists.push_back(IndexSet{sentence_lookup(corpus, clause[0].attribute, clause[0].value), 0});
+            continue;
+        }
+        SentenceCursor cursor{corpus};
+        Match m;
+        for_each_position(plan_query(corpus, Query{clause}), [&](Position t){
+            if(cursor.to_match(t, 1, m) && (matched[i].empty() || matched[i].back() != m.sentence)){
+                matched[i].push_back(m.sentence);
+            }
+        });
+        lists.push_back(IndexSet{matched[i], 0});
+    }
+    //Only empty clauses, which match any token
+    if(lists.empty()){
+        std::vector<Position> all;
+        for(Position s = 0; s < num_sentences; s++){
+            if(corpus.sentences[s + 1] > corpus.sentences[s]){
+                all.push_back(s);
+            }
+        }
+        return all;
+    }
+    return traced("sentences", lists.size(), 0, [&lists](){
+        trace_algorithm("kway");
+        return kway_intersection(lists).elems;
+    });
+}
+//Intersects posting lists all at once, only positions that are in every list are stored.
+//Positions before the start of the corpus can not start a match and are left out.
+ExplicitSet kway_intersection(const std::vector<IndexSet> &sets){
+    QueryPlan plan;
+    plan.include = sets;
+    std::sort(plan.include.begin(), plan.include.end(), [](const IndexSet &a, const IndexSet &b){ return a.elems.size() < b.elems.size(); });
+    ExplicitSet C;
+    if(plan.include.empty() || plan.include[0].elems.empty()){
+        return C;
+    }
+    plan.range.first = 0;
+    plan.range.last = plan.include[0].elems.back() - plan.include[0].shift;
+    for_each_position(plan, [&C](Position t){
+        push_charged(C.elems, t);
+    });
+    return C;
+}
+//True if a query is a phrase of words and the corpus has a suffix array to find it in
+bool use_suffix_array(const Corpus &corpus, const Query &query){
+    return !corpus.word_suffixes.empty() && (int)query.size() >= phrase_min_clauses && is_phrase(query);
+}
+//Finds the start positions of a phrase query in the suffix array, returns false if intersecting the
+//posting lists is cheaper. Sorting the occurrences of the phrase costs about r log r, the intersection
+//about the smallest posting list once per clause.
+bool locate_phrase(const Corpus &corpus, const Query &query, std::vector<Position> &positions){
+    std::span<const Position> range = phrase_range(corpus, query);
+    Position smallest = corpus.tokens.size();
+    for(const Clause &clause: query){
+        smallest = std::min<Position>(smallest, posting_size(corpus, "word", clause[0].value));
+    }
+    double r = range.size();
+    if(r * std::log2(r + 1) > 2.0 * smallest * query.size()){
+        return false;
+    }
+    positions = traced("lookup", query.size(), smallest, [&corpus, &query, range](){
+        trace_algorithm("suffix_array");
+        if(active_trace){
+            for(const Clause &clause: query){
+                active_trace->pending.detail += "[word=\"" + corpus.index2string[clause[0].value] + "\"]";
+            }
+        }
+        return sorted_positions(range);
+    });
+    return true;
+}
+//Plans a query with whichever of the suffix array, the posting lists or a scan of the tokens is cheapest
+QueryPlan plan_query(const Corpus &corpus, const Query &query, const LookupCache *cache){
+    QueryPlan plan;
+    plan.range.first = 0;
+    plan.range.last = (Position)corpus.tokens.size() - std::max<Position>(query.size(), 1);
+    std::vector<Position> phrase;
+    if(use_suffix_array(corpus, query) && locate_phrase(corpus, query, phrase)){
+        plan.phrase = std::make_shared<const std::vector<Position>>(std::move(phrase));
+        plan.include.push_back(IndexSet{*plan.phrase, 0});
+        return plan;
+    }
+    //Literals on attributes without an index can only be checked by a scan
+    for(const Clause &clause: query){
+        for(const Literal &literal: clause){
+            if(!is_indexed(corpus, literal.attribute)){
+                return scan_plan(corpus, query);
+            }
+        }
+    }
+    plan = index_plan(corpus, query, cache);
+    //Unselective literals have long posting lists, one pass over the tokens is then cheaper
+    QueryPlan scan = scan_plan(corpus, query);
+    if(scan_cost(scan) < index_cost(plan)){
+        return scan;
+    }
+    return plan;
+}
+//Looks up every literal of a query, or a view that covers it, without combining them
+QueryPlan index_plan(const Corpus &corpus, const Query &query, const LookupCache *cache){
+    QueryPlan plan;
+    plan.range.first = 0;
+    plan.range.last = (Position)corpus.tokens.size() - std::max<Position>(query.size(), 1);
+    std::vector<MatchSet> sets;
+    for(int i = 0; i < (int)query.size(); i++){
+        if(!query[i].empty()){
+            match_set(corpus, query[i], i, sets, cache);
+        }
+    }
+    for(MatchSet &m: sets){
+        //Decoded lists are owned by the plan
+        if(ExplicitSet *decoded = std::get_if<ExplicitSet>(&m.set)){
+            plan.decoded.push_back(std::make_shared<const std::vector<Position>>(std::move(decoded->elems)));
+            m.set = IndexSet{*plan.decoded.back(), 0};
+        }
+        (m.complement ? plan.exclude : plan.include).push_back(std::get<IndexSet>(m.set));
+    }
+    std::sort(plan.include.begin(), plan.include.end(), [](const IndexSet &a, const IndexSet &b){ return a.elems.size() < b.elems.size(); });
+    return plan;
+}
+//A plan that scans the tokens, predicates that let the fewest positions through are checked first.
+//Literals on attributes with a byte column compare codes, a value that is not in the column is
+//never matched, so its equality empties the plan and its inequality is left out.
+QueryPlan scan_plan(const Corpus &corpus, const Query &query){
+    QueryPlan plan;
+    plan.range.first = 0;
+    plan.range.last = (Position)corpus.tokens.size() - std::max<Position>(query.size(), 1);
+    plan.scan = true;
+    plan.tokens = corpus.tokens;
+    std::vector<std::pair<Position, ScanPredicate>> ordered;
+    for(int i = 0; i < (int)query.size(); i++){
+        for(const Literal &literal: query[i]){
+            Position size = posting_size(corpus, literal.attribute, literal.value);
+            Position passing = literal.is_equality ? size : (Position)corpus.tokens.size() - size;
+            ScanPredicate p{attribute_member(literal.attribute), literal.value, nullptr, 0, literal.is_equality, i};
+            const ByteColumn &column = byte_column(corpus, literal.attribute);
+            if(!column.codes.empty()){
+                auto code = std::find(column.values.begin(), column.values.end(), literal.value);
+                if(code == column.values.end()){
+                    if(literal.is_equality){
+                        plan.range.last = -1;
+                    }
+                    continue;
+                }
+                p.codes = column.codes.data();
+                p.code = code - column.values.begin();
+            }
+            ordered.push_back({passing, p});
+        }
+    }
+    std::stable_sort(ordered.begin(), ordered.end(), [](const auto &a, const auto &b){ return a.first < b.first; });
+    for(auto &[passing, predicate]: ordered){
+        plan.predicates.push_back(predicate);
+    }
+    return plan;
+}
+//Estimated time of intersecting the posting lists of a plan in nanoseconds. Candidates come from the
+//smallest list (and the next one when they are merged as a pair) or the whole range. A single source
+//is only copied, otherwise every other list is merged with the candidates or gallops to each one.
+double index_cost(const QueryPlan &plan){
+    bool walk_pair = PlanCursor(plan).walk_pair;
+    double candidates = plan.include.empty() ? get_size(plan.range) : get_size(plan.include[0]);
+    double touched = candidates + (walk_pair ? get_size(plan.include[1]) : 0);
+    int filters = plan.include.size() + plan.exclude.size() - std::min<int>(plan.include.size(), walk_pair ? 2 : 1);
+    if(filters == 0 && !walk_pair){
+        return index_copy_ns * touched;
+    }
+    for(int i = walk_pair ? 2 : 1; i < (int)plan.include.size(); i++){
+        touched += std::min<double>(get_size(plan.include[i]), 8 * candidates);
+    }
+    for(const IndexSet &s: plan.exclude){
+        touched += std::min<double>(get_size(s), 8 * candidates);
+    }
+    return index_merge_ns * touched;
+}
+//Estimated time of scanning the range of a plan in nanoseconds, every position is produced and every
+//predicate is checked against its byte column or the tokens
+double scan_cost(const QueryPlan &plan){
+    double per_position = scan_position_ns;
+    for(const ScanPredicate &p: plan.predicates){
+        per_position += p.codes ? scan_byte_ns : scan_token_ns;
+    }
+    return get_size(plan.range) * per_position;
+}
 //Compares sizes of two sets
 bool comp_size(const MatchSet &A, const MatchSet &B){
-    int size_A = std::visit([](auto&& arg) { return get_size(arg); }, A.set);
-    int size_B = std::visit([](auto&& arg) { return get_size(arg); }, B.set);
+    Position size_A = std::visit([](auto&& arg) { return get_size(arg); }, A.set);
+    Position size_B = std::visit([](auto&& arg) { return get_size(arg); }, B.set);
     return size_A < size_B;
 }
 //Get size functions for all types of sets
-int get_size(const IndexSet &A){
+Position get_size(const IndexSet &A){
     return A.elems.size();
 }
-int get_size(const ExplicitSet &A){
+Position get_size(const ExplicitSet &A){
     return A.elems.size();
 }
-int get_size(const DenseSet &A){
+Position get_size(const DenseSet &A){
     return A.last - A.first + 1;
 }
+Position get_size(const MatchSet &A){
+    return std::visit([](auto&& arg) { return get_size(arg); }, A.set);
+}
 //Get all matches from a query
 std::vector<Match> match2(const Corpus &corpus, const Query &query){
-    std::vector<Match> matches;
-    MatchSet m = match_set(corpus, query);
+    QueryPlan plan = plan_query(corpus, query);
     int size = query.size();
-    matches = std::visit([&corpus, &size](auto&& arg1){ return match2(corpus, arg1, size); }, m.set);
-    return matches;
+    long left = plan.scan || plan.include.empty() ? get_size(plan.range) : get_size(plan.include[0]);
+    long right = 0;
+    for(const IndexSet &s: plan.exclude){
+        right += get_size(s);
+    }
+    //Evaluating the plan and building the matches is one step, positions are never stored
+    return traced("match2", left, right, [&corpus, &plan, size](){
+        trace_algorithm(plan.scan ? "scan" : "kway");
+        if(active_trace){
+            active_trace->pending.detail = plan.scan ? std::to_string(plan.predicates.size()) + " predicates"
+                : std::to_string(plan.include.size()) + " include, " + std::to_string(plan.exclude.size()) + " exclude";
+        }
+        std::vector<Match> matches;
+        SentenceCursor cursor{corpus};
+        Match m;
+        for_each_position(plan, [&](Position t){
+            if(cursor.to_match(t, size, m)){
+                push_charged(matches, m);
+            }
+        });
+        return matches;
+    });
+}
+//Sets m to the match starting at t, returns false if the match does not fit in its sentence
+bool SentenceCursor::to_match(Position t, int size, Match &m){
+    if(t < 0 || t >= (Position)corpus.tokens.size()){
+        return false;
+    }
+    //Increasing positions mostly stay in the sentence of the previous one or land a few sentences
+    //later, so the search gallops ahead from it. That touches the same cache lines as the previous
+    //search, which neither a full binary search nor the Eytzinger layout does for sorted positions.
+    const std::vector<Position> &sentences = corpus.sentences;
+    if(sentences[sentence] > t){
+        sentence = sentence_of(corpus, t);
+    } else if(sentences[sentence + 1] <= t){
+        Position n = sentences.size();
+        Position lo = sentence + 1;
+        Position step = 1;
+        Position hi = lo + 1;
+        while(hi < n && sentences[hi] <= t){
+            lo = hi;
+            step *= 2;
+            hi = lo + step;
+        }
+        sentence = std::upper_bound(sentences.begin() + lo, sentences.begin() + std::min(hi, n), t) - sentences.begin() - 1;
+    }
+    m.sentence = sentence;
+    m.len = size;
+    m.pos = t - corpus.sentences[sentence];
+    return corpus.sentences[sentence] + m.pos + m.len <= corpus.sentences[sentence + 1];
 }
 //Match functions for all types of sets
 std::vector<Match> match2(const Corpus &corpus, const ExplicitSet &M, int size){
     std::vector<Match> matches;
-    for(const int &t:M.elems){
-        auto sentence = std::upper_bound(corpus.sentences.begin(), corpus.sentences.end(), t);
-        int sentence_index = std::distance(corpus.sentences.begin(), sentence) - 1;
+    for(const Position &t:M.elems){
+        Position sentence_index = sentence_of(corpus, t);
         Match m;
         m.sentence = sentence_index;
         m.len = size;
         m.pos = t - corpus.sentences[sentence_index];
         if(corpus.sentences[sentence_index] + m.pos + m.len <= corpus.sentences[sentence_index + 1]){
-            matches.push_back(m);
+            push_charged(matches, m);
         }
+        poll_budget(1);
     }
     return matches;
 }
 std::vector<Match> match2(const Corpus &corpus, const IndexSet &M, int size){
     std::vector<Match> matches;
-    for(const int &t:M.elems){
-        auto sentence = std::upper_bound(corpus.sentences.begin(), corpus.sentences.end(), t);
-        int sentence_index = std::distance(corpus.sentences.begin(), sentence) - 1;
+    for(const Position &t:M.elems){
+        Position sentence_index = sentence_of(corpus, t);
         Match m;
         m.sentence = sentence_index;
         m.len = size;
         m.pos = t - corpus.sentences[sentence_index];
         if(corpus.sentences[sentence_index] + m.pos + m.len <= corpus.sentences[sentence_index + 1]){
-            matches.push_back(m);
+            push_charged(matches, m);
         }
+        poll_budget(1);
     }
     return matches;
 }
 std::vector<Match> match2(const Corpus &corpus, const DenseSet &M, int size){
     std::vector<Match> matches;
-    for(int i = M.first; i <= M.last; i++){
-        auto sentence = std::upper_bound(corpus.sentences.begin(), corpus.sentences.end(), i);
-        int sentence_index = std::distance(corpus.sentences.begin(), sentence) - 1;
+    for(Position i = M.first; i <= M.last; i++){
+        Position sentence_index = sentence_of(corpus, i);
         Match m;
         m.sentence = sentence_index;
         m.len = size;
         m.pos = i - corpus.sentences[sentence_index];
         if(corpus.sentences[sentence_index] + m.pos + m.len <= corpus.sentences[sentence_index + 1]){
-            matches.push_back(m);
+            push_charged(matches, m);
         }
+        poll_budget(1);
     }
     return matches;
 }
@@ -411,7 +1217,7 @@ std::vector<Match> match(const Corpus &corpus, const Query &query){
         bool first_token = true;
         int pos = 0;
         int current_clause = 0;
-        int index = 0;
+        Position index = 0;
         int sentence_length = corpus.sentences[index + 1] - corpus.sentences[index];
         for(Token t: corpus.tokens){
             if(pos >= sentence_length){
@@ -427,7 +1233,8 @@ std::vector<Match> match(const Corpus &corpus, const Query &query){
                 pos++;
                 continue;
             }
-            std::unordered_map<std::string, std::uint32_t> tokenMap = {{"c5", t.c5},{"pos", t.pos},{"lemma", t.lemma}, {"word", t.word}};
+            std::unordered_map<std::string, std::uint32_t> tokenMap = {{"c5", t.c5},{"pos", t.pos},{"lemma", t.lemma}, {"word", t.word},
+                {"folded_word", t.folded_word}, {"folded_lemma", t.folded_lemma}};
             bool all_literals_matching = true;
             if(!query[current_clause].empty()){
                 //Loops through each literal in a query until the end or until the literal dousnt match the token
@@ -473,416 +1280,441 @@ std::vector<Match> match(const Corpus &corpus, const std::string &query_string){
 
 //Returns a set that is the intersection of two sets
 MatchSet intersection(const MatchSet &A, const MatchSet &B){
-    MatchSet m;
-    //If both sets are complements, get the union of them and set that as a complement
-    if(A.complement && B.complement){
-        m.complement = true;
-        m.set = std::visit([](auto&& arg1, auto&& arg2) -> std::variant<DenseSet, IndexSet, ExplicitSet>{ return set_union(arg1, arg2); }, A.set, B.set);
-        return m;                        
-    } 
-    //If one of the sets is a complement, get the difference between them instead
-    else if (A.complement && !std::holds_alternative<DenseSet>(B.set)){
-        m.complement = false;
-        m.set = std::visit([](auto&& arg1, auto&& arg2) -> std::variant<DenseSet, IndexSet, ExplicitSet>{ return difference(arg1, arg2); }, B.set, A.set);
-        return m;
-    } else if (B.complement && !std::holds_alternative<DenseSet>(A.set)){
-        m.complement = false;
-        m.set = std::visit([](auto&& arg1, auto&& arg2) -> std::variant<DenseSet, IndexSet, ExplicitSet>{ return difference(arg1, arg2); }, A.set, B.set);
-        return m;
-    } else{
-        m.set = std::visit([](auto&& arg1, auto&& arg2) -> std::variant<DenseSet, IndexSet, ExplicitSet>{ return intersection(arg1, arg2); }, A.set, B.set);
-        m.complement = (A.complement && B.complement);
-        return m;
-    }
-}
-//Functions for returning the differenxe for different combinations of sets
-ExplicitSet difference(const IndexSet &A, const IndexSet &B){
-    ExplicitSet C;
-    if(A.elems.size() < B.elems.size() / 10){
-        for(int x:A.elems){
-            int t = x - A.shift;
-            if(!std::binary_search(B.elems.begin(), B.elems.end(), t + B.shift)){
-                C.elems.push_back(t);
-            }
-        }
-        return C;
-    } 
-    int p = 0;
-    int q = 0;
-    while(p < (int)A.elems.size() && q < (int)B.elems.size()){
-        if(A.elems[p] - A.shift < B.elems[q] - B.shift){
-            C.elems.push_back(A.elems[p] - A.shift);
-            p++;
-        } else if(A.elems[p] - A.shift > B.elems[q] - B.shift){
-            q++;
+    return traced("intersection", get_size(A), get_size(B), [&A, &B](){
+        MatchSet m;
+        m.complement = A.complement && B.complement;
+        //If both sets are complements, get the union of them and set that as a complement
+        if(A.complement && B.complement){
+            trace_operator("union");
+            m.set = std::visit([](auto&& arg1, auto&& arg2) -> std::variant<DenseSet, IndexSet, ExplicitSet>{ return set_union(arg1, arg2); }, A.set, B.set);
+        } 
+        //If one of the sets is a complement, get the difference between them instead
+        else if(A.complement){
+            trace_operator("difference");
+            m.set = std::visit([](auto&& arg1, auto&& arg2) -> std::variant<DenseSet, IndexSet, ExplicitSet>{ return difference(arg1, arg2); }, B.set, A.set);
+        } else if(B.complement){
+            trace_operator("difference");
+            m.set = std::visit([](auto&& arg1, auto&& arg2) -> std::variant<DenseSet, IndexSet, ExplicitSet>{ return difference(arg1, arg2); }, A.set, B.set);
         } else{
-            p++;
-            q++;
+            m.set = std::visit([](auto&& arg1, auto&& arg2) -> std::variant<DenseSet, IndexSet, ExplicitSet>{ return intersection(arg1, arg2); }, A.set, B.set);
         }
-    }
-    while(p < (int)A.elems.size()){
-        C.elems.push_back(A.elems[p] - A.shift);
-        p++;
-    }
-    return C;
+        return m;
+    });
 }
 
-ExplicitSet difference(const ExplicitSet &A, const IndexSet &B){
-    ExplicitSet C;
-    if(A.elems.size() < B.elems.size() / 10){
-        for(int x:A.elems){
-            if(!std::binary_search(B.elems.begin(), B.elems.end(), x + B.shift)){
-                C.elems.push_back(x);
-            }
-        }
-        return C;
-    } 
-    int p = 0;
-    int q = 0;
-    while(p < (int)A.elems.size() && q < (int)B.elems.size()){
-        if(A.elems[p] < B.elems[q] - B.shift){
-            C.elems.push_back(A.elems[p]);
-            p++;
-        } else if(A.elems[p] > B.elems[q] - B.shift){
-            q++;
-        } else{
-            p++;
-            q++;
-        }
+//The set operations below are written once against views. A view is a sorted sequence of positions
+//with the shift already applied, so each pairing of set types and shifts gets its own compiled loops.
+//Sets with a shift compare shifted positions, this is decided at compile time.
+template <bool Shifted>
+struct SpanView
+{
+    std::span<const Position> elems;
+    Position shift;
+    Position size() const{
+        return elems.size();
     }
-    while(p < (int)A.elems.size()){
-        C.elems.push_back(A.elems[p]);
-        p++;
+    Position operator[](Position i) const{
+        return Shifted ? elems[i] - shift : elems[i];
     }
-    return C;
-}
-ExplicitSet difference(const ExplicitSet &A, const ExplicitSet &B){
-    ExplicitSet C;
-    if(A.elems.size() < B.elems.size() / 10){
-        for(int x:A.elems){
-            if(!std::binary_search(B.elems.begin(), B.elems.end(),x)){
-                C.elems.push_back(x);
-            }
+    //Index of the first position >= x at or after from. Gallops ahead and then binary searches,
+    //so probing increasing positions costs the log of the distance moved instead of the whole set.
+    Position seek(Position from, Position x) const{
+        //Sets of similar size mostly move a few positions, which a short scan finds fastest
+        Position end = std::min<Position>(from + 8, size());
+        while(from < end && (*this)[from] < x){
+            from++;
         }
-        return C;
-    } 
-    int p = 0;
-    int q = 0;
-    while(p < (int)A.elems.size() && q < (int)B.elems.size()){
-        if(A.elems[p] < B.elems[q]){
-            C.elems.push_back(A.elems[p]);
-            p++;
-        } else if(A.elems[p] > B.elems[q]){
-            q++;
-        } else{
-            p++;
-            q++;
+        if(from < end || from == size()){
+            return from;
         }
-    }
-    while(p < (int)A.elems.size()){
-        C.elems.push_back(A.elems[p]);
-        p++;
-    }
-    return C;
-}
-
-ExplicitSet difference(const IndexSet &A, const ExplicitSet &B){
-    ExplicitSet C;
-    if(A.elems.size() < B.elems.size() / 10){
-        for(int x:A.elems){
-            int t = x - A.shift;
-            if(!std::binary_search(B.elems.begin(), B.elems.end(), t)){
-                C.elems.push_back(t);
-            }
+        Position step = 1;
+        Position hi = from;
+        while(hi < size() && (*this)[hi] < x){
+            from = hi + 1;
+            hi += step;
+            step *= 2;
         }
-        return C;
-    } 
-    int p = 0;
-    int q = 0;
-    while(p < (int)A.elems.size() && q < (int)B.elems.size()){
-        if(A.elems[p] - A.shift < B.elems[q]){
-            C.elems.push_back(A.elems[p] - A.shift);
-            p++;
-        } else if(A.elems[p] - A.shift > B.elems[q]){
-            q++;
-        } else{
-            p++;
-            q++;
+        hi = std::min(hi, size());
+        while(from < hi){
+            Position mid = from + (hi - from) / 2;
+            if((*this)[mid] < x){
+                from = mid + 1;
+            } else{
+                hi = mid;
+            }
         }
+        return from;
     }
-    while(p < (int)A.elems.size()){
-        C.elems.push_back(A.elems[p] - A.shift);
-        p++;
+};
+struct DenseView
+{
+    Position first;
+    Position last;
+    Position size() const{
+        return std::max<Position>(last - first + 1, 0);
     }
-    return C;
-}
-ExplicitSet difference(const DenseSet &A, const ExplicitSet &B){
-    ExplicitSet C;
-    int p = A.first;
-    int q = 0;
-    while(p <= A.last && q < (int)B.elems.size()){
-        if(p < B.elems[q]){
-            C.elems.push_back(p);
-            p++;
-        } else if(p > B.elems[q]){
-            q++;
-        } else{
-            p++;
-            q++;
-        }
+    Position operator[](Position i) const{
+        return first + i;
     }
-    while(p < A.last){
-        C.elems.push_back(p);
-        p++;
+    Position seek(Position from, Position x) const{
+        return std::clamp<Position>(x - first, from, size());
     }
-    return C;
+};
+template <typename V>
+constexpr bool is_dense = std::is_same_v<V, DenseView>;
+
+//Calls f with the view of a set
+template <typename F>
+auto with_view(const DenseSet &s, F f){
+    return f(DenseView{s.first, s.last});
 }
-ExplicitSet difference(const DenseSet &A, const IndexSet &B){
-    ExplicitSet C;
-    int p = A.first;
-    int q = 0;
-    while(p <= A.last && q < (int)B.elems.size()){
-        if(p < B.elems[q] - B.shift){
-            C.elems.push_back(p);
-            p++;
-        } else if(p > B.elems[q] - B.shift){
-            q++;
-        } else{
-            p++;
-            q++;
-        }
+template <typename F>
+auto with_view(const IndexSet &s, F f){
+    if(s.shift == 0){
+        return f(SpanView<false>{s.elems, 0});
     }
-    while(p < A.last){
-        C.elems.push_back(p);
-        p++;
-    }
-    return C;
+    return f(SpanView<true>{s.elems, s.shift});
 }
-template <typename T1, typename T2>
-ExplicitSet difference(const T1&, const T2&) {
-    return ExplicitSet{}; 
+template <typename F>
+auto with_view(const ExplicitSet &s, F f){
+    return f(SpanView<false>{s.elems, 0});
 }
 
-//Functions for gettng the intersections for all combinations of sets
-ExplicitSet intersection(const IndexSet &A, const IndexSet &B){
-    ExplicitSet C;
-    if(A.elems.size() < B.elems.size() / 10){
-        for(int x:A.elems){
-            int t = x - A.shift;
-            if(std::binary_search(B.elems.begin(), B.elems.end(), t + B.shift)){
-                C.elems.push_back(t);
-            }
+//Appends positions [from, to) of a view
+template <typename V>
+void append_range(std::vector<Position> &out, const V &a, Position from, Position to){
+    charge_budget(std::max<long>(to - from, 0) * sizeof(Position));
+    out.reserve(out.size() + std::max<Position>(to - from, 0));
+    for(Position i = from; i < to; i++){
+        out.push_back(a[i]);
+        if((i & (budget_poll_work - 1)) == 0){
+            poll_budget(budget_poll_work);
         }
-        return C;
-    } else if(B.elems.size() < A.elems.size() / 10){
-        for(int x:B.elems){
-            int t = x - B.shift;
-            if(std::binary_search(A.elems.begin(), A.elems.end(), t + A.shift)){
-                C.elems.push_back(t);
-            }
-        }
-        return C;
     }
-    int p = 0;
-    int q = 0;
-    while(p < (int)A.elems.size() && q < (int)B.elems.size()){
-        if(A.elems[p] - A.shift < B.elems[q] - B.shift){
-            p++;
-        } else if(A.elems[p] - A.shift > B.elems[q] - B.shift){
-            q++;
-        } else{
-            C.elems.push_back(A.elems[p] - A.shift);
-            p++;
-            q++;
+}
+//Keeps the positions of a that are (or with Keep false, are not) in b. Each position of a is found
+//in b with seek, which wins over a merge when a is much smaller than b or b is dense.
+template <bool Keep, typename VA, typename VB>
+ExplicitSet probe_views(const VA &a, const VB &b){
+    ExplicitSet C;
+    Position j = 0;
+    for(Position i = 0; i < a.size(); i++){
+        Position x = a[i];
+        j = b.seek(j, x);
+        if((j < b.size() && b[j] == x) == Keep){
+            push_charged(C.elems, x);
+        }
+        if((i & (budget_poll_work - 1)) == 0){
+            poll_budget(budget_poll_work);
         }
     }
     return C;
 }
-ExplicitSet intersection(const IndexSet &A, const DenseSet &B){
-    std::vector<int> shifted;
-    for(int i: A.elems){
-        if(i - A.shift <= B.last && i - A.shift >= B.first){
-            shifted.push_back(i-A.shift);
+//Merges with the branches of the loop replaced by arithmetic, the output is written past its end
+//and only counted when it belongs there, so the loop does not stall on unpredictable comparisons
+template <typename VA, typename VB>
+ExplicitSet intersect_views(const VA &a, const VB &b){
+    if constexpr(is_dense<VA> && !is_dense<VB>){
+        return intersect_views(b, a);
+    } else if constexpr(is_dense<VB>){
+        //Positions of a inside the range are one block
+        trace_algorithm("range");
+        ExplicitSet C;
+        Position from = a.seek(0, b.first);
+        append_range(C.elems, a, from, a.seek(from, b.last + 1));
+        return C;
+    } else{
+        if(a.size() < b.size() / 10){
+            trace_algorithm("galloping");
+            return probe_views<true>(a, b);
+        } else if(b.size() < a.size() / 10){
+            trace_algorithm("galloping");
+            return probe_views<true>(b, a);
         }
-    }
-    return ExplicitSet{shifted};
-}
-ExplicitSet intersection(const IndexSet &A, const ExplicitSet &B){
-    ExplicitSet C;
-    if(A.elems.size() < B.elems.size() / 10){
-        for(int x:A.elems){
-            int t = x - A.shift;
-            if(std::binary_search(B.elems.begin(), B.elems.end(), t)){
-                C.elems.push_back(t);
+        trace_algorithm("merge");
+        ExplicitSet C;
+        charge_budget(std::min(a.size(), b.size()) * sizeof(Position));
+        C.elems.resize(std::min(a.size(), b.size()));
+        Position *out = C.elems.data();
+        Position k = 0;
+        Position p = 0;
+        Position q = 0;
+        while(p < a.size() && q < b.size()){
+            //The budget is checked between chunks so the inner loop stays free of it
+            Position p_end = std::min<Position>(a.size(), p + budget_poll_work);
+            Position q_end = std::min<Position>(b.size(), q + budget_poll_work);
+            while(p < p_end && q < q_end){
+                Position x = a[p];
+                Position y = b[q];
+                out[k] = x;
+                k += x == y;
+                p += x <= y;
+                q += y <= x;
             }
+            poll_budget(budget_poll_work);
         }
+        C.elems.resize(k);
         return C;
-    } else if(B.elems.size() < A.elems.size() / 10){
-        for(int x:B.elems){
-            if(std::binary_search(A.elems.begin(), A.elems.end(), x + A.shift)){
-                C.elems.push_back(x);
+    }
+}
+template <typename VA, typename VB>
+ExplicitSet subtract_views(const VA &a, const VB &b){
+    if constexpr(is_dense<VB>){
+        //Everything of a before and after the range
+        trace_algorithm("range");
+        ExplicitSet C;
+        Position from = a.seek(0, b.first);
+        append_range(C.elems, a, 0, from);
+        append_range(C.elems, a, a.seek(from, b.last + 1), a.size());
+        return C;
+    } else{
+        if(!is_dense<VA> && a.size() < b.size() / 10){
+            trace_algorithm("galloping");
+            return probe_views<false>(a, b);
+        }
+        trace_algorithm("merge");
+        ExplicitSet C;
+        charge_budget(a.size() * sizeof(Position));
+        C.elems.resize(a.size());
+        Position *out = C.elems.data();
+        Position k = 0;
+        Position p = 0;
+        Position q = 0;
+        while(p < a.size() && q < b.size()){
+            Position p_end = std::min<Position>(a.size(), p + budget_poll_work);
+            Position q_end = std::min<Position>(b.size(), q + budget_poll_work);
+            while(p < p_end && q < q_end){
+                Position x = a[p];
+                Position y = b[q];
+                out[k] = x;
+                k += x < y;
+                p += x <= y;
+                q += y <= x;
             }
+            poll_budget(budget_poll_work);
         }
+        C.elems.resize(k);
+        append_range(C.elems, a, p, a.size());
         return C;
     }
-    int p = 0;
-    int q = 0;
-    while(p < (int)A.elems.size() && q < (int)B.elems.size()){
-        if(A.elems[p] - A.shift < B.elems[q]){
-            p++;
-        } else if(A.elems[p] - A.shift > B.elems[q]){
-            q++;
-        } else{
-            C.elems.push_back(A.elems[p] - A.shift);
-            p++;
-            q++;
+}
+template <typename VA, typename VB>
+ExplicitSet unite_views(const VA &a, const VB &b){
+    trace_algorithm("merge");
+    ExplicitSet C;
+    charge_budget((a.size() + b.size()) * sizeof(Position));
+    C.elems.resize(a.size() + b.size());
+    Position *out = C.elems.data();
+    Position k = 0;
+    Position p = 0;
+    Position q = 0;
+    while(p < a.size() && q < b.size()){
+        Position p_end = std::min<Position>(a.size(), p + budget_poll_work);
+        Position q_end = std::min<Position>(b.size(), q + budget_poll_work);
+        while(p < p_end && q < q_end){
+            Position x = a[p];
+            Position y = b[q];
+            out[k++] = std::min(x, y);
+            p += x <= y;
+            q += y <= x;
         }
+        poll_budget(budget_poll_work);
     }
+    C.elems.resize(k);
+    append_range(C.elems, a, p, a.size());
+    append_range(C.elems, b, q, b.size());
     return C;
 }
+
+//Set operations for every combination of set types
+template <PositionSet A, PositionSet B>
+ExplicitSet intersection(const A &a, const B &b){
+    return with_view(a, [&b](const auto &va){
+        return with_view(b, [&va](const auto &vb){ return intersect_views(va, vb); });
+    });
+}
+template <PositionSet A, PositionSet B>
+ExplicitSet difference(const A &a, const B &b){
+    return with_view(a, [&b](const auto &va){
+        return with_view(b, [&va](const auto &vb){ return subtract_views(va, vb); });
+    });
+}
+template <PositionSet A, PositionSet B>
+ExplicitSet set_union(const A &a, const B &b){
+    return with_view(a, [&b](const auto &va){
+        return with_view(b, [&va](const auto &vb){ return unite_views(va, vb); });
+    });
+}
 DenseSet intersection(const DenseSet &A, const DenseSet &B){
+    trace_algorithm("range");
     DenseSet D;
     D.first = std::max(A.first, B.first);
     D.last = std::min(A.last, B.last);
     return D;
 }
-ExplicitSet intersection(const DenseSet &A, const ExplicitSet &B){
-    std::vector<int> v;
-    for (int i : B.elems){
-        if(i > A.last){
-            return ExplicitSet{v};
+template ExplicitSet intersection(const IndexSet &A, const IndexSet &B);
+template ExplicitSet intersection(const IndexSet &A, const ExplicitSet &B);
+template ExplicitSet intersection(const IndexSet &A, const DenseSet &B);
+template ExplicitSet intersection(const ExplicitSet &A, const IndexSet &B);
+template ExplicitSet intersection(const ExplicitSet &A, const ExplicitSet &B);
+template ExplicitSet intersection(const ExplicitSet &A, const DenseSet &B);
+template ExplicitSet intersection(const DenseSet &A, const IndexSet &B);
+template ExplicitSet intersection(const DenseSet &A, const ExplicitSet &B);
+template ExplicitSet difference(const IndexSet &A, const IndexSet &B);
+template ExplicitSet difference(const IndexSet &A, const ExplicitSet &B);
+template ExplicitSet difference(const IndexSet &A, const DenseSet &B);
+template ExplicitSet difference(const ExplicitSet &A, const IndexSet &B);
+template ExplicitSet difference(const ExplicitSet &A, const ExplicitSet &B);
+template ExplicitSet difference(const ExplicitSet &A, const DenseSet &B);
+template ExplicitSet difference(const DenseSet &A, const IndexSet &B);
+template ExplicitSet difference(const DenseSet &A, const ExplicitSet &B);
+template ExplicitSet difference(const DenseSet &A, const DenseSet &B);
+template ExplicitSet set_union(const IndexSet &A, const IndexSet &B);
+template ExplicitSet set_union(const IndexSet &A, const ExplicitSet &B);
+template ExplicitSet set_union(const IndexSet &A, const DenseSet &B);
+template ExplicitSet set_union(const ExplicitSet &A, const IndexSet &B);
+template ExplicitSet set_union(const ExplicitSet &A, const ExplicitSet &B);
+template ExplicitSet set_union(const ExplicitSet &A, const DenseSet &B);
+template ExplicitSet set_union(const DenseSet &A, const IndexSet &B);
+template ExplicitSet set_union(const DenseSet &A, const ExplicitSet &B);
+template ExplicitSet set_union(const DenseSet &A, const DenseSet &B);
+
+PlanCursor::PlanCursor(const QueryPlan &plan)
+    : plan(plan), at(plan.include.size(), 0), excluded_at(plan.exclude.size(), 0), candidate(plan.range.first){
+    walk_pair = plan.include.size() >= 2 && plan.include[1].elems.size() / 10 < plan.include[0].elems.size();
+}
+//Keeps the candidates that are (or with Keep false, are not) in a list. When the list holds few
+//positions between the first and last candidate it is merged with them, otherwise it gallops forward
+//to each candidate in turn. Either way the candidate is written back without branching on the result.
+template <bool Keep>
+int filter_block(const IndexSet &s, Position &at, Position *out, int k){
+    if(k == 0){
+        return 0;
+    }
+    SpanView<true> view{s.elems, s.shift};
+    int kept = 0;
+    int c = 0;
+    if(view.seek(at, out[k - 1]) - at < 8 * k){
+        while(c < k && at < view.size()){
+            Position x = out[c];
+            Position y = view[at];
+            out[kept] = x;
+            kept += Keep ? x == y : x < y;
+            c += x <= y;
+            at += y <= x;
         }
-        v.push_back(i);
     }
-    return ExplicitSet{v};
+    for(; c < k; c++){
+        Position x = out[c];
+        at = view.seek(at, x);
+        bool found = at < view.size() && view[at] == x;
+        out[kept] = x;
+        kept += found == Keep;
+    }
+    return kept;
 }
-ExplicitSet intersection(const ExplicitSet &A, const ExplicitSet &B){
-    ExplicitSet C;
-    if(A.elems.size() < B.elems.size() / 10){
-        for(int x:A.elems){
-            if(std::binary_search(B.elems.begin(), B.elems.end(), x)){
-                C.elems.push_back(x);
-            }
+//Writes up to n positions to out and returns how many were written, 0 once the plan is exhausted.
+//Candidates come a block at a time from the smallest list, or from the two smallest merged when
+//their sizes are close, then every other list removes the candidates it does not agree with.
+int PlanCursor::next(Position *out, int n){
+    if(plan.scan){
+        return scan(out, n);
+    }
+    while(candidate <= plan.range.last){
+        int k = propose(out, n);
+        poll_budget(k);
+        if(k == 0){
+            candidate = plan.range.last + 1;
+            break;
         }
-        return C;
-    } else if(B.elems.size() < A.elems.size() / 10){
-        for(int x:B.elems){
-            if(std::binary_search(A.elems.begin(), A.elems.end(), x)){
-                C.elems.push_back(x);
-            }
+        candidate = out[k - 1] + 1;
+        for(int i = walk_pair ? 2 : 1; i < (int)plan.include.size(); i++){
+            k = filter_block<true>(plan.include[i], at[i], out, k);
         }
-        return C;
-    }
-    int p = 0;
-    int q = 0;
-    while(p < (int)A.elems.size() && q < (int)B.elems.size()){
-        if(A.elems[p] < B.elems[q]){
-            p++;
-        } else if(A.elems[p] > B.elems[q]){
-            q++;
-        } else{
-            C.elems.push_back(A.elems[p]);
-            p++;
-            q++;
+        for(int j = 0; j < (int)plan.exclude.size(); j++){
+            k = filter_block<false>(plan.exclude[j], excluded_at[j], out, k);
         }
-    }
-    return C;
-}
-ExplicitSet intersection(const DenseSet &A, const IndexSet &B){
-    return intersection(B, A);
-}
-ExplicitSet intersection(const ExplicitSet &A, const IndexSet &B){
-    return intersection(B, A);
-}
-ExplicitSet intersection(const ExplicitSet &A, const DenseSet &B){
-    return intersection(B, A);
-}
-ExplicitSet set_union(const IndexSet &A, const IndexSet &B){
-    ExplicitSet C;
-    int p = 0;
-    int q = 0;
-    while(p < (int)A.elems.size() && q < (int)B.elems.size()){
-        if(A.elems[p] - A.shift < B.elems[q] - B.shift){
-            C.elems.push_back(A.elems[p] - A.shift);
-            p++;
-        } else if(A.elems[p] - A.shift > B.elems[q] - B.shift){
-            C.elems.push_back(B.elems[q] - B.shift);
-            q++;
-        } else{
-            C.elems.push_back(A.elems[p] - A.shift);
-            p++;
-            q++;
+        k = std::upper_bound(out, out + k, plan.range.last) - out;
+        if(k > 0){
+            return k;
         }
     }
-    while(p < (int)A.elems.size()){
-        C.elems.push_back(A.elems[p] - A.shift);
-        p++;
-    }
-    while(q < (int)B.elems.size()){
-        C.elems.push_back(B.elems[q] - B.shift);
-        q++;
-    }
-    return C;
+    return 0;
 }
-//Functions for getting the union of all combinations of sets
-ExplicitSet set_union(const ExplicitSet &A, const IndexSet &B){
-    ExplicitSet C;
-    int p = 0;
-    int q = 0;
-    while(p < (int)A.elems.size() && q < (int)B.elems.size()){
-        if(A.elems[p] < B.elems[q] - B.shift){
-            C.elems.push_back(A.elems[p]);
-            p++;
-        } else if(A.elems[p] > B.elems[q] - B.shift){
-            C.elems.push_back(B.elems[q] - B.shift);
-            q++;
-        } else{
-            C.elems.push_back(A.elems[p]);
-            p++;
-            q++;
+//Writes up to n candidates >= candidate to out
+int PlanCursor::propose(Position *out, int n){
+    int k = 0;
+    if(plan.include.empty()){
+        for(; k < n && candidate + k <= plan.range.last; k++){
+            out[k] = candidate + k;
         }
+        return k;
     }
-    while(p < (int)A.elems.size()){
-        C.elems.push_back(A.elems[p]);
-        p++;
+    SpanView<true> a{plan.include[0].elems, plan.include[0].shift};
+    Position p = a.seek(at[0], candidate);
+    if(!walk_pair){
+        for(; k < n && p < a.size(); k++, p++){
+            out[k] = a[p];
+        }
+        at[0] = p;
+        return k;
     }
-    while(q < (int)B.elems.size()){
-        C.elems.push_back(B.elems[q] - B.shift);
-        q++;
+    //The same branch free merge as intersect_views, stopped when the block is full
+    SpanView<true> b{plan.include[1].elems, plan.include[1].shift};
+    Position q = b.seek(at[1], candidate);
+    while(k < n && p < a.size() && q < b.size()){
+        Position x = a[p];
+        Position y = b[q];
+        out[k] = x;
+        k += x == y;
+        p += x <= y;
+        q += y <= x;
     }
-    return C;
+    at[0] = p;
+    at[1] = q;
+    return k;
 }
-ExplicitSet set_union(const IndexSet &A, const ExplicitSet &B){
-    return set_union(B,A);
-}
-ExplicitSet set_union(const ExplicitSet &A, const ExplicitSet &B){
-    ExplicitSet C;
-    int p = 0;
-    int q = 0;
-    while(p < (int)A.elems.size() && q < (int)B.elems.size()){
-        if(A.elems[p] < B.elems[q]){
-            C.elems.push_back(A.elems[p]);
-            p++;
-        } else if(A.elems[p] > B.elems[q]){
-            C.elems.push_back(B.elems[q]);
-            q++;
-        } else{
-            C.elems.push_back(A.elems[p]);
-            p++;
-            q++;
+//Checks the next block of positions against every predicate. Each predicate clears the flag of the
+//positions it rejects without branching, so the compiler turns the loop into vector compares over
+//the byte columns, and the rest of the predicates are skipped once no position in the block is left.
+int PlanCursor::scan(Position *out, int n){
+    while(candidate <= plan.range.last){
+        int size = std::min<Position>({(Position)n, (Position)scan_block, plan.range.last - candidate + 1});
+        uint8_t keep[scan_block];
+        std::fill(keep, keep + size, 1);
+        for(const ScanPredicate &p: plan.predicates){
+            uint8_t rejected = !p.is_equality;
+            uint8_t any = 0;
+            if(p.codes){
+                const uint8_t *c = p.codes + candidate + p.shift;
+                uint8_t code = p.code;
+                for(int i = 0; i < size; i++){
+                    keep[i] &= (c[i] == code) ^ rejected;
+                    any |= keep[i];
+                }
+            } else{
+                const Token *t = plan.tokens.data() + candidate + p.shift;
+                uint32_t Token::* attribute = p.attribute;
+                uint32_t value = p.value;
+                for(int i = 0; i < size; i++){
+                    keep[i] &= (t[i].*attribute == value) ^ rejected;
+                    any |= keep[i];
+                }
+            }
+            if(!any){
+                break;
+            }
+        }
+        int k = 0;
+        for(int i = 0; i < size; i++){
+            out[k] = candidate + i;
+            k += keep[i];
+        }
+        candidate += size;
+        poll_budget(size);
+        if(k > 0){
+            return k;
         }
     }
-    while(p < (int)A.elems.size()){
-        C.elems.push_back(A.elems[p]);
-        p++;
-    }
-    while(q < (int)B.elems.size()){
-        C.elems.push_back(B.elems[q]);
-        q++;
-    }
-    return C;
+    return 0;
 }
-template <typename T1, typename T2>
-ExplicitSet set_union(const T1&, const T2&) {
-    return ExplicitSet{}; 
-}
\ No newline at end of file
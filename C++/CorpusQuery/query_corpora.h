@@ -6,12 +6,30 @@
 #include <map>
 #include <variant>
 #include <cstdint>
+#include <istream>
+#include <ostream>
+#include <concepts>
+#include <memory>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+//Token positions and sentence ids. 32 bit by default to keep indices compact, build with
+//POS64=1 (-DCORPUS_POS64) for corpora of more than 2^31 tokens.
+#ifdef CORPUS_POS64
+using Position = int64_t;
+#else
+using Position = int32_t;
+#endif
 struct Token
 {
     uint32_t word;
     uint32_t c5;
     uint32_t lemma;
     uint32_t pos;
+    //Shadow attributes: the folded form of word and lemma, see fold
+    uint32_t folded_word;
+    uint32_t folded_lemma;
 };
 struct Literal
 {
@@ -22,87 +40,401 @@ struct Literal
 using Sentence = std::vector<Token>;
 struct Match
 {
-    int sentence;
+    Position sentence;
     int pos;
     int len;
 };
-using Index = std::vector<int>;
+using Index = std::vector<Position>;
+//Sorted positions in Eytzinger order: node 1 is the root and node k has children 2k and 2k + 1, so the
+//top levels of a search share a few cache lines and the nodes three levels down can be prefetched while
+//comparing. Every node keeps its rank in the sorted order, node 0 has the number of positions.
+struct EytzingerNode
+{
+    Position key;
+    Position rank;
+};
+using EytzingerTree = std::vector<EytzingerNode>;
+EytzingerTree eytzinger_layout(std::span<const Position> sorted);
+//Rank of the first position greater than x, the same as std::upper_bound on the sorted positions
+inline Position eytzinger_upper_bound(const EytzingerTree &tree, Position x){
+    size_t n = tree.size();
+    size_t k = 1;
+    while(k < n){
+        //Nodes 8k to 8k + 7 are the great-grandchildren
+        __builtin_prefetch(tree.data() + (8 * k < n ? 8 * k : 0));
+        k = 2 * k + (tree[k].key <= x);
+    }
+    //The answer is the node of the last left turn, every right turn after it is undone
+    k >>= __builtin_ffsll(~k);
+    return tree[k].rank;
+}
+//Sentences every value occurs in, in compressed sparse row layout: the sentences of value v are
+//ids[offsets[v]] up to ids[offsets[v + 1]], sorted and each sentence once
+struct SentenceIndex
+{
+    std::vector<Position> offsets;
+    std::vector<Position> ids;
+};
+//An attribute with at most 255 distinct values kept as one code per token, scans read it instead of the
+//tokens. values[c] is the value of code c, both are empty for attributes with more values.
+struct ByteColumn
+{
+    std::vector<uint32_t> values;
+    std::vector<uint8_t> codes;
+};
+//How the posting lists of an attribute are kept. plain is the token index, a binary search finds a list
+//as a span. The others save memory: compressed lists and bitmaps are decoded at lookup, and attributes
+//without an index are only matched by scanning the tokens.
+enum class IndexKind
+{
+    plain,
+    compressed,
+    bitmap,
+    none
+};
+//Posting lists of an attribute in a representation other than plain, its token index is then empty
+struct PackedIndex
+{
+    IndexKind kind = IndexKind::plain;
+    //Values the attribute has, sorted, and the number of tokens of each. Kept for every kind, so the
+    //planner can still order literals without an index.
+    std::vector<uint32_t> values;
+    std::vector<Position> counts;
+    //compressed: the list of values[i] is bytes[offsets[i]] up to bytes[offsets[i + 1]], the first position
+    //and then the gaps between positions as LEB128 varints
+    std::vector<uint64_t> offsets;
+    std::vector<uint8_t> bytes;
+    //bitmap: a bit per token for every value, the words of values[i] start at i * words_per_value
+    std::vector<uint64_t> bits;
+    size_t words_per_value = 0;
+};
+using Clause = std::vector<Literal>;
+//Positions of a combination of literals on one token, precomputed because queries use it often. A clause
+//that has every literal of a view reads its positions instead of intersecting their posting lists.
+struct MaterializedView
+{
+    Clause literals;
+    std::vector<Position> positions;
+};
 struct Corpus
 {
     std::vector<Token> tokens;
-    std::vector<int> sentences;
+    std::vector<Position> sentences;
     std::vector<std::string> index2string;        
     std::map<std::string, uint32_t> string2index; 
+    //Id of the folded form of every string in index2string
+    std::vector<uint32_t> folded;
     Index word_index;
     Index c5_index;    
     Index lemma_index; 
     Index pos_index; 
+    Index folded_word_index;
+    Index folded_lemma_index;
+    SentenceIndex word_sentences;
+    SentenceIndex c5_sentences;
+    SentenceIndex lemma_sentences;
+    SentenceIndex pos_sentences;
+    SentenceIndex folded_word_sentences;
+    SentenceIndex folded_lemma_sentences;
+    ByteColumn word_column;
+    ByteColumn c5_column;
+    ByteColumn lemma_column;
+    ByteColumn pos_column;
+    //Suffix array over the word ids, empty unless build_suffix_array was called
+    Index word_suffixes;
+    //Sentence starts in Eytzinger order, only built with CORPUS_EYTZINGER
+    EytzingerTree sentence_tree;
+    //Frequent literal combinations, empty unless attach_views was called
+    std::vector<MaterializedView> views;
+    //Attributes whose index is not plain, see pack_indices
+    std::map<std::string, PackedIndex> packed;
 };;
-using Clause = std::vector<Literal>;
 using Query = std::vector<Clause>;
 struct IndexSet
 {
-    std::span<const int> elems;
+    std::span<const Position> elems;
     int shift;
 };
 struct DenseSet
 {
-    int first;
-    int last;
+    Position first;
+    Position last;
 };
 struct ExplicitSet
 {
-    std::vector<int> elems;
+    std::vector<Position> elems;
 };
+//The set types, set operations are instantiated for every pair of them
+template <typename T>
+concept PositionSet = std::same_as<T, DenseSet> || std::same_as<T, IndexSet> || std::same_as<T, ExplicitSet>;
+//Posting lists of literals that were looked up ahead of time, keyed by attribute and value
+using LookupCache = std::map<std::pair<std::string, uint32_t>, IndexSet>;
 struct MatchSet
 {
     std::variant<DenseSet, IndexSet, ExplicitSet> set;
     bool complement; 
 };
+//Sentence that contains token t. Builds with EYTZINGER=1 (-DCORPUS_EYTZINGER) search the Eytzinger
+//layout of the sentence starts, others binary search the sentences from sentence from on.
+inline Position sentence_of(const Corpus &corpus, Position t, Position from = 0){
+#ifdef CORPUS_EYTZINGER
+    return eytzinger_upper_bound(corpus.sentence_tree, t) - 1;
+#else
+    return std::upper_bound(corpus.sentences.begin() + from, corpus.sentences.end(), t) - corpus.sentences.begin() - 1;
+#endif
+}
+//Turns increasing token positions into matches, each lookup starts at the previous sentence
+struct SentenceCursor
+{
+    const Corpus &corpus;
+    Position sentence = 0;
+    bool to_match(Position t, int size, Match &m);
+};
+//Calls f for every position in a set in increasing order
+template <typename F>
+void for_each_position(const DenseSet &s, F f){
+    for(Position i = s.first; i <= s.last; i++){
+        f(i);
+    }
+}
+template <typename F>
+void for_each_position(const IndexSet &s, F f){
+    for(Position x: s.elems){
+        f(x - s.shift);
+    }
+}
+template <typename F>
+void for_each_position(const ExplicitSet &s, F f){
+    for(Position x: s.elems){
+        f(x);
+    }
+}
+//A literal compiled for a scan: the attribute of the token at the clause offset is compared with the value,
+//or the code of the value in the byte column of the attribute if it has one
+struct ScanPredicate
+{
+    uint32_t Token::* attribute;
+    uint32_t value;
+    const uint8_t *codes;
+    uint8_t code;
+    bool is_equality;
+    int shift;
+};
+//A query kept as an operator tree that is only evaluated by its consumer. Queries are conjunctions,
+//so the tree is flat: every literal stays a view of its posting list with its clause offset as shift,
+//complements stay exclusions and no intermediate sets are built.
+struct QueryPlan
+{
+    //Posting lists every position is in, smallest first
+    std::vector<IndexSet> include;
+    //Posting lists no position is in
+    std::vector<IndexSet> exclude;
+    //Positions a match can start at
+    DenseSet range;
+    //Positions of a phrase found in the suffix array, include views them
+    std::shared_ptr<const std::vector<Position>> phrase;
+    //Posting lists decoded from packed indices, include and exclude view them
+    std::vector<std::shared_ptr<const std::vector<Position>>> decoded;
+    //Set when the tokens are scanned instead of intersecting the posting lists, every literal is
+    //then a predicate, most selective first
+    bool scan = false;
+    std::span<const Token> tokens;
+    std::vector<ScanPredicate> predicates;
+};
+//Produces the positions of a plan in increasing order, a block at a time. All include lists are
+//intersected in one pass: the smallest lists propose candidates and every other list gallops to them,
+//so only positions that survive every list are written out.
+struct PlanCursor
+{
+    const QueryPlan &plan;
+    std::vector<Position> at;
+    std::vector<Position> excluded_at;
+    Position candidate;
+    bool walk_pair;
+    PlanCursor(const QueryPlan &plan);
+    int next(Position *out, int n);
+    int propose(Position *out, int n);
+    int scan(Position *out, int n);
+};
+template <typename F>
+void for_each_position(const QueryPlan &plan, F f){
+    PlanCursor cursor(plan);
+    Position block[256];
+    for(int n = cursor.next(block, 256); n > 0; n = cursor.next(block, 256)){
+        for(int i = 0; i < n; i++){
+            f(block[i]);
+        }
+    }
+}
+//One operator of a query, recorded when a trace is active
+struct TraceEvent
+{
+    std::string op;
+    std::string algorithm;
+    std::string detail;
+    long left;
+    long right;
+    long output;
+    long bytes;
+    double ms;
+};
+struct QueryTrace
+{
+    std::vector<TraceEvent> events;
+    //The event being recorded, operators fill in the algorithm they pick
+    TraceEvent pending;
+};
+//The trace queries on this thread record into, nothing is recorded when it is null
+extern thread_local QueryTrace *active_trace;
+//Makes queries on this thread record into a trace for as long as the scope exists
+struct TraceScope
+{
+    QueryTrace *previous;
+    TraceScope(QueryTrace &trace);
+    ~TraceScope();
+};
+inline void trace_algorithm(const char *algorithm){
+    if(active_trace){
+        active_trace->pending.algorithm = algorithm;
+    }
+}
+inline void trace_operator(const char *op){
+    if(active_trace){
+        active_trace->pending.op = op;
+    }
+}
+void print_trace(std::ostream &out, const QueryTrace &trace);
+//Thrown out of a query that was cancelled or went over its time or memory budget
+struct QueryAborted : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+//Limits of the queries on a thread. Loops over positions poll it every few thousand positions and
+//intermediate sets and matches are charged to it before they are allocated.
+struct QueryBudget
+{
+    //Set from any thread or a signal handler to stop the query at its next poll
+    std::atomic<bool> cancelled = false;
+    //Wall time and bytes allocated for intermediate sets and matches, 0 for no limit. Freed sets are
+    //not given back, so the memory limit also bounds the peak from above.
+    double time_ms = 0;
+    long memory_bytes = 0;
+    std::chrono::steady_clock::time_point start;
+    //Shared by the worker threads of a query
+    std::atomic<long> allocated = 0;
+};
+//Positions processed between two checks of the clock and the cancellation flag
+const long budget_poll_work = 1 << 16;
+//The budget queries on this thread are held to, nothing is checked when it is null
+extern thread_local QueryBudget *active_budget;
+//Work done on this thread since the budget was last checked
+extern thread_local long budget_work;
+//Holds queries on this thread to a budget for as long as the scope exists, the time starts now
+struct BudgetScope
+{
+    QueryBudget *previous;
+    BudgetScope(QueryBudget &budget);
+    ~BudgetScope();
+};
+//Holds a worker thread of a query to the budget of the thread that started it, without restarting its clock
+struct WorkerBudgetScope
+{
+    QueryBudget *previous;
+    WorkerBudgetScope(QueryBudget *budget);
+    ~WorkerBudgetScope();
+};
+void check_budget();
+void exceed_memory(long bytes);
+//Adds work done to the active budget and checks it once enough has been done
+inline void poll_budget(long work){
+    if(active_budget && (budget_work += work) >= budget_poll_work){
+        check_budget();
+    }
+}
+//Charges bytes about to be allocated to the active budget
+inline void charge_budget(long bytes){
+    if(active_budget && (active_budget->allocated += bytes) > active_budget->memory_bytes && active_budget->memory_bytes > 0){
+        exceed_memory(bytes);
+    }
+}
+//Appends to intermediate results, charging every reallocation by the bytes it adds
+template <typename T>
+void push_charged(std::vector<T> &v, const T &x){
+    if(v.size() == v.capacity()){
+        charge_budget(std::max<long>(v.capacity(), 1) * sizeof(T));
+    }
+    v.push_back(x);
+}
 Corpus load_corpus(const std::string &filename);
+void load_tokens(std::istream &f, Corpus &dictionary, Corpus &target);
 Index build_index(const std::vector<Token> &tokens, uint32_t Token::* attribute);
 void build_indices(Corpus &corpus);
+void build_indices(Corpus &corpus, uint32_t num_keys);
+void build_indices(const std::vector<Token> &tokens, uint32_t num_keys, const std::vector<uint32_t Token::*> &attributes, const std::vector<Index*> &indices);
+int build_threads(size_t num_tokens, uint32_t num_keys);
+ByteColumn build_byte_column(const std::vector<Token> &tokens, uint32_t Token::* attribute);
+void build_byte_columns(Corpus &corpus);
+void build_sentence_tree(Corpus &corpus);
+const ByteColumn &byte_column(const Corpus &corpus, const std::string &attribute);
+void build_sentence_indices(const Corpus &corpus, uint32_t num_keys, const std::vector<uint32_t Token::*> &attributes, const std::vector<const Index*> &token_indices, const std::vector<SentenceIndex*> &indices);
+std::span<const Position> sentence_lookup(const Corpus &corpus, const std::string &attribute, uint32_t value);
 Query parse_query(const std::string &text, const Corpus &corpus);
 bool attribute_is_valid(std::string &attr);
+uint32_t Token::* attribute_member(const std::string &attribute);
 IndexSet index_lookup(const Corpus &corpus, const std::string &attribute, uint32_t value);
+IndexSet index_lookup(const Index &index, const std::vector<Token> &tokens, uint32_t Token::* attribute, uint32_t value);
+const PackedIndex *packed_index(const Corpus &corpus, const std::string &attribute);
+bool is_indexed(const Corpus &corpus, const std::string &attribute);
+Position posting_size(const Corpus &corpus, const std::string &attribute, uint32_t value);
+std::vector<Position> decode_postings(const Corpus &corpus, const std::string &attribute, const PackedIndex &packed, uint32_t value);
+LookupCache resolve_literals(const Corpus &corpus, const std::vector<Query> &queries);
 MatchSet intersection(const MatchSet &A, const MatchSet &B);
-ExplicitSet intersection(const IndexSet &A, const IndexSet &B);
-ExplicitSet intersection(const IndexSet &A, const DenseSet &B);
-ExplicitSet intersection(const IndexSet &A, const ExplicitSet &B);
+template <PositionSet A, PositionSet B>
+ExplicitSet intersection(const A &a, const B &b);
+template <PositionSet A, PositionSet B>
+ExplicitSet difference(const A &a, const B &b);
+template <PositionSet A, PositionSet B>
+ExplicitSet set_union(const A &a, const B &b);
 DenseSet intersection(const DenseSet &A, const DenseSet &B);
-ExplicitSet intersection(const DenseSet &A, const ExplicitSet &B);
-ExplicitSet intersection(const ExplicitSet &A, const ExplicitSet &B);
-ExplicitSet intersection(const DenseSet &A, const IndexSet &B);
-ExplicitSet intersection(const ExplicitSet &A, const IndexSet &B);
-ExplicitSet intersection(const ExplicitSet &A, const DenseSet &B);
-ExplicitSet difference(const IndexSet &A, const IndexSet &B);
-ExplicitSet difference(const ExplicitSet &A, const IndexSet &B);
-ExplicitSet difference(const ExplicitSet &A, const ExplicitSet &B);
-ExplicitSet difference(const IndexSet &A, const ExplicitSet &B);
-ExplicitSet difference(const DenseSet &A, const ExplicitSet &B);
-ExplicitSet difference(const DenseSet &A, const IndexSet &B);
-template <typename T1, typename T2>
-ExplicitSet difference(const T1&, const T2&);
-ExplicitSet set_union(const IndexSet &A, const IndexSet &B);
-ExplicitSet set_union(const IndexSet &A, const ExplicitSet &B);
-ExplicitSet set_union(const ExplicitSet &A, const ExplicitSet &B);
-ExplicitSet set_union(const ExplicitSet &A, const IndexSet &B);
-template <typename T1, typename T2>
-ExplicitSet set_union(const T1&, const T2&);
-std::span<const int> shift(const IndexSet &s);
+std::span<const Position> shift(const IndexSet &s);
 std::vector<Match> match(const Corpus &corpus, const Query &query);
 std::vector<Match> match(const Corpus &corpus, const std::string &query_string);
 std::vector<Match> match_single(const Corpus &corpus, const std::string &attr, const std::string &value);
-MatchSet match_set(const Corpus &corpus, const Literal &literal, int shift);
-void match_set(const Corpus &corpus, const Clause &clause, int shift, std::vector<MatchSet> &sets);
-MatchSet match_set(const Corpus &corpus, const Query &query);
+MatchSet match_set(const Corpus &corpus, const Literal &literal, int shift, const LookupCache *cache = nullptr);
+void match_set(const Corpus &corpus, const Clause &clause, int shift, std::vector<MatchSet> &sets, const LookupCache *cache = nullptr);
+std::vector<const MaterializedView*> covering_views(const Corpus &corpus, const Clause &clause, std::vector<bool> &covered);
+MatchSet match_set(const Corpus &corpus, const Query &query, const LookupCache *cache = nullptr);
+//Positive literals in a query from which match_set intersects them with kway_intersection
+//instead of a pairwise fold
+const int kway_min_sets = 3;
+ExplicitSet kway_intersection(const std::vector<IndexSet> &sets);
+std::vector<Position> match_sentences(const Corpus &corpus, const Query &query);
+QueryPlan plan_query(const Corpus &corpus, const Query &query, const LookupCache *cache = nullptr);
+//Positions a scan checks at once
+const int scan_block = 256;
+//Cost model of the planner in nanoseconds, measured on a 5M token corpus: a posting list element that is
+//copied or merged, a position produced by a scan and a predicate checked on a byte column or the tokens
+const double index_copy_ns = 1.0;
+const double index_merge_ns = 4.5;
+const double scan_position_ns = 1.0;
+const double scan_byte_ns = 0.25;
+const double scan_token_ns = 2.0;
+QueryPlan index_plan(const Corpus &corpus, const Query &query, const LookupCache *cache = nullptr);
+QueryPlan scan_plan(const Corpus &corpus, const Query &query);
+double index_cost(const QueryPlan &plan);
+double scan_cost(const QueryPlan &plan);
+bool use_suffix_array(const Corpus &corpus, const Query &query);
+bool locate_phrase(const Corpus &corpus, const Query &query, std::vector<Position> &positions);
 bool comp_size(const MatchSet &A, const MatchSet &B);
-int get_size(const IndexSet &A);
-int get_size(const ExplicitSet &A);
-int get_size(const DenseSet &A);
+Position get_size(const IndexSet &A);
+Position get_size(const ExplicitSet &A);
+Position get_size(const DenseSet &A);
+Position get_size(const MatchSet &A);
 std::vector<Match> match2(const Corpus &corpus, const Query &query);
 std::vector<Match> match2(const Corpus &corpus, const ExplicitSet &M, int size);
 std::vector<Match> match2(const Corpus &corpus, const IndexSet &M, int size);
 std::vector<Match> match2(const Corpus &corpus, const DenseSet &M, int size);
 Token generate_token(Corpus &corpus, std::string t_word, std::string t_c5, std::string t_lemma, std::string t_pos);
+uint32_t intern(Corpus &corpus, const std::string &s);
+std::string fold(const std::string &s);
 #endif
\ No newline at end of file
@@ -0,0 +1,113 @@
+#include <iostream>
+#include <chrono>
+#include <stdexcept>
+#include <algorithm>
+#include "reload.h"
+#include "suffix_array.h"
+#include "views.h"
+//Loads, indexes and places a corpus into a snapshot that is never changed again
+CorpusPtr load_snapshot(const std::string &filename, const SnapshotOptions &options){
+    std::shared_ptr<Corpus> corpus = std::make_shared<Corpus>(load_corpus(filename));
+    if(corpus->tokens.empty()){
+        throw std::invalid_argument("Corpus " + filename + " has no tokens");
+    }
+    build_indices(*corpus);
+    if(options.suffix_array){
+        build_suffix_array(*corpus);
+    }
+    if(!options.views.empty()){
+        ViewReport report = attach_views(*corpus, filename, options.views);
+        std::cerr << (report.loaded ? "Loaded " : "Built ") << report.views << " views of " << report.positions << " positions in " << report.ms << " ms" << std::endl;
+        if(!report.error.empty()){
+            std::cerr << "Warning: views are not saved, " << report.error << std::endl;
+        }
+    }
+    IndexConfig indices = options.indices;
+    if(options.memory_budget > 0){
+        indices = fit_indices(*corpus, options.memory_budget, indices);
+        std::cerr << "Indices: " << format_index_config(indices) << std::endl;
+    }
+    pack_indices(*corpus, indices);
+    if(options.placement.huge_pages || options.placement.interleave){
+        PlacementReport report = place_corpus(*corpus, options.placement);
+        if(!report.error.empty()){
+            std::cerr << "Warning: arrays stay on the default pages, " << report.error << std::endl;
+        }
+    }
+    return corpus;
+}
+
+//Pins the current snapshot, it stays valid for as long as the pointer is held
+CorpusPtr acquire(const LiveCorpus &live){
+    return live.current.load(std::memory_order_acquire);
+}
+
+//Makes a snapshot the current one and returns the one it replaced. Queries that pinned the
+//old snapshot finish on it, queries started after the store see the new one.
+CorpusPtr publish(LiveCorpus &live, CorpusPtr corpus){
+    CorpusPtr old = live.current.exchange(std::move(corpus), std::memory_order_acq_rel);
+    live.version++;
+    return old;
+}
+
+//Frees retired snapshots once it holds the last reference to them, so neither a query nor the
+//prompt pays for freeing a corpus
+void start_reaper(LiveCorpus &live){
+    live.reaper = std::jthread([&live](std::stop_token stop){
+        while(!stop.stop_requested()){
+            std::vector<CorpusPtr> unpinned;
+            {
+                std::unique_lock<std::mutex> guard(live.lock);
+                live.retire_signal.wait(guard, stop, [&live]{ return !live.retired.empty(); });
+                auto pinned = std::partition(live.retired.begin(), live.retired.end(), [](const CorpusPtr &c){ return c.use_count() > 1; });
+                unpinned.assign(std::make_move_iterator(pinned), std::make_move_iterator(live.retired.end()));
+                live.retired.erase(pinned, live.retired.end());
+            }
+            //Freed here, outside the lock
+            unpinned.clear();
+            std::this_thread::sleep_for(std::chrono::milliseconds(retire_poll_ms));
+        }
+    });
+}
+
+//Loads a corpus in the background and swaps it in when it is indexed. The replaced snapshot goes
+//to the reaper, so the loader is done once it has published and the next reload never waits for it.
+void reload(LiveCorpus &live, const std::string &filename, const SnapshotOptions &options){
+    if(live.loading.exchange(true)){
+        throw std::invalid_argument("A corpus is already being loaded");
+    }
+    {
+        std::lock_guard<std::mutex> guard(live.lock);
+        live.error.clear();
+    }
+    if(!live.reaper.joinable()){
+        start_reaper(live);
+    }
+    //The previous loader has published or failed, it only has to return
+    live.loader = std::jthread([&live, filename, options](){
+        try{
+            auto start = std::chrono::steady_clock::now();
+            CorpusPtr corpus = load_snapshot(filename, options);
+            long tokens = corpus->tokens.size();
+            CorpusPtr old = publish(live, std::move(corpus));
+            {
+                std::lock_guard<std::mutex> guard(live.lock);
+                live.retired.push_back(std::move(old));
+            }
+            live.retire_signal.notify_one();
+            std::chrono::duration<double, std::milli> d = std::chrono::steady_clock::now() - start;
+            std::cerr << "Loaded " << filename << " as snapshot " << live.version << ", " << tokens << " tokens in " << d.count() << " ms" << std::endl;
+        } catch(const std::exception &e){
+            std::lock_guard<std::mutex> guard(live.lock);
+            live.error = e.what();
+            std::cerr << "Error: " << e.what() << std::endl;
+        }
+        live.loading = false;
+    });
+}
+
+//Error of the last failed reload, empty if it succeeded
+std::string reload_error(const LiveCorpus &live){
+    std::lock_guard<std::mutex> guard(live.lock);
+    return live.error;
+}
@@ -0,0 +1,54 @@
+#ifndef RELOAD_H
+#define RELOAD_H
+#include "query_corpora.h"
+#include "placement.h"
+#include "footprint.h"
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+using CorpusPtr = std::shared_ptr<const Corpus>;
+//How a snapshot is built once its tokens are loaded
+struct SnapshotOptions
+{
+    bool suffix_array = false;
+    PlacementOptions placement;
+    //File of literal combinations to materialize as views, none if empty
+    std::string views;
+    //Representation of the index of every attribute, plain for those left out
+    IndexConfig indices;
+    //Bytes the whole corpus may take, the indices are packed until it fits, 0 for no limit
+    long memory_budget = 0;
+};
+//A corpus that can be replaced while it is queried. Every query pins the current snapshot and
+//keeps it alive until it finishes, a reload loads and indexes the new corpus on a background
+//thread and publishes it with one atomic store, so queries never wait for it.
+struct LiveCorpus
+{
+    std::atomic<CorpusPtr> current;
+    //Number of snapshots published, the first is 1
+    std::atomic<long> version = 0;
+    //Set while a new corpus is being loaded, there is one load at a time
+    std::atomic<bool> loading = false;
+    //Error of the last reload that failed, guarded by lock
+    std::string error;
+    //Replaced snapshots that may still be pinned, guarded by lock
+    std::vector<CorpusPtr> retired;
+    mutable std::mutex lock;
+    std::condition_variable_any retire_signal;
+    //Loads the next snapshot and hands the one it replaced to the reaper, which frees it once no
+    //query or page of results holds it. Declared last so they are stopped and joined before the
+    //other members are destroyed.
+    std::jthread loader;
+    std::jthread reaper;
+};
+//Interval at which the reaper checks whether the retired snapshots are still pinned
+const int retire_poll_ms = 10;
+CorpusPtr load_snapshot(const std::string &filename, const SnapshotOptions &options);
+CorpusPtr acquire(const LiveCorpus &live);
+CorpusPtr publish(LiveCorpus &live, CorpusPtr corpus);
+void start_reaper(LiveCorpus &live);
+void reload(LiveCorpus &live, const std::string &filename, const SnapshotOptions &options);
+std::string reload_error(const LiveCorpus &live);
+#endif
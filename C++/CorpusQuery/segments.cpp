@@ -0,0 +1,265 @@
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include "segments.h"
+#include "suffix_array.h"
+//Reads new text from a file into a fresh segment
+void append_segment(SegmentedCorpus &corpus, const std::string &filename){
+    std::ifstream f(filename);
+    if(!f){
+        throw std::invalid_argument("Can not open " + filename);
+    }
+    append_segment(corpus, f);
+}
+
+//Reads new text into a fresh segment, only the new tokens are indexed so the cost is proportional to the new data
+void append_segment(SegmentedCorpus &corpus, std::istream &f){
+    auto segment = std::make_shared<Segment>();
+    uint32_t num_keys;
+    {
+        //New strings are added to the shared dictionary, so queries being parsed must wait
+        std::lock_guard<std::mutex> guard(corpus.lock);
+        load_tokens(f, corpus.dictionary, segment->corpus);
+        num_keys = corpus.dictionary.index2string.size();
+    }
+    if(segment->corpus.tokens.empty()){
+        return;
+    }
+    build_indices(segment->corpus, num_keys);
+    if(corpus.suffix_array){
+        build_suffix_array(segment->corpus);
+    }
+    std::lock_guard<std::mutex> guard(corpus.lock);
+    if(corpus.segments.empty()){
+        segment->token_offset = 0;
+        segment->sentence_offset = 0;
+    } else{
+        const Segment &last = *corpus.segments.back();
+        segment->token_offset = last.token_offset + last.corpus.tokens.size();
+        segment->sentence_offset = last.sentence_offset + last.corpus.sentences.size() - 1;
+    }
+    corpus.segments.push_back(segment);
+    corpus.merge_signal.notify_one();
+}
+
+//Returns the current segments, they stay valid for as long as the caller holds them
+std::vector<SegmentPtr> snapshot(const SegmentedCorpus &corpus){
+    std::lock_guard<std::mutex> guard(corpus.lock);
+    return corpus.segments;
+}
+
+//Total number of tokens and sentences in a list of segments
+Position num_tokens(const std::vector<SegmentPtr> &segments){
+    if(segments.empty()){
+        return 0;
+    }
+    return segments.back()->token_offset + segments.back()->corpus.tokens.size();
+}
+Position num_sentences(const std::vector<SegmentPtr> &segments){
+    if(segments.empty()){
+        return 0;
+    }
+    return segments.back()->sentence_offset + segments.back()->corpus.sentences.size() - 1;
+}
+
+//Merges two neighbouring segments, B must directly follow A in the corpus
+Segment merge_segments(const Segment &A, const Segment &B){
+    Segment C;
+    C.token_offset = A.token_offset;
+    C.sentence_offset = A.sentence_offset;
+    Position offset = A.corpus.tokens.size();
+    std::vector<Token> &tokens = C.corpus.tokens;
+    tokens.reserve(A.corpus.tokens.size() + B.corpus.tokens.size());
+    tokens.insert(tokens.end(), A.corpus.tokens.begin(), A.corpus.tokens.end());
+    tokens.insert(tokens.end(), B.corpus.tokens.begin(), B.corpus.tokens.end());
+    //The last boundary of A is the same as the first boundary of B
+    std::vector<Position> &sentences = C.corpus.sentences;
+    sentences.reserve(A.corpus.sentences.size() + B.corpus.sentences.size() - 1);
+    sentences.insert(sentences.end(), A.corpus.sentences.begin(), A.corpus.sentences.end() - 1);
+    for(Position s: B.corpus.sentences){
+        sentences.push_back(s + offset);
+    }
+    //Both indices are already sorted, so they are merged instead of rebuilt
+    C.corpus.lemma_index = merge_index(A.corpus.lemma_index, B.corpus.lemma_index, offset, tokens, &Token::lemma);
+    C.corpus.c5_index = merge_index(A.corpus.c5_index, B.corpus.c5_index, offset, tokens, &Token::c5);
+    C.corpus.word_index = merge_index(A.corpus.word_index, B.corpus.word_index, offset, tokens, &Token::word);
+    C.corpus.pos_index = merge_index(A.corpus.pos_index, B.corpus.pos_index, offset, tokens, &Token::pos);
+    C.corpus.folded_word_index = merge_index(A.corpus.folded_word_index, B.corpus.folded_word_index, offset, tokens, &Token::folded_word);
+    C.corpus.folded_lemma_index = merge_index(A.corpus.folded_lemma_index, B.corpus.folded_lemma_index, offset, tokens, &Token::folded_lemma);
+    Position sentence_offset = A.corpus.sentences.size() - 1;
+    C.corpus.lemma_sentences = merge_sentence_index(A.corpus.lemma_sentences, B.corpus.lemma_sentences, sentence_offset);
+    C.corpus.c5_sentences = merge_sentence_index(A.corpus.c5_sentences, B.corpus.c5_sentences, sentence_offset);
+    C.corpus.word_sentences = merge_sentence_index(A.corpus.word_sentences, B.corpus.word_sentences, sentence_offset);
+    C.corpus.pos_sentences = merge_sentence_index(A.corpus.pos_sentences, B.corpus.pos_sentences, sentence_offset);
+    C.corpus.folded_word_sentences = merge_sentence_index(A.corpus.folded_word_sentences, B.corpus.folded_word_sentences, sentence_offset);
+    C.corpus.folded_lemma_sentences = merge_sentence_index(A.corpus.folded_lemma_sentences, B.corpus.folded_lemma_sentences, sentence_offset);
+    build_byte_columns(C.corpus);
+    build_sentence_tree(C.corpus);
+    //Suffixes of A run on into B, so the suffix array is rebuilt
+    if(!A.corpus.word_suffixes.empty() || !B.corpus.word_suffixes.empty()){
+        build_suffix_array(C.corpus);
+    }
+    return C;
+}
+
+//Merges two sentence indices, every sentence of B comes after all sentences of A so the sentences of
+//a value are those of A followed by those of B moved by offset. B may know more values than A.
+SentenceIndex merge_sentence_index(const SentenceIndex &A, const SentenceIndex &B, Position offset){
+    SentenceIndex C;
+    size_t num_keys = std::max(A.offsets.size(), B.offsets.size()) - 1;
+    C.offsets.resize(num_keys + 1, 0);
+    C.ids.reserve(A.ids.size() + B.ids.size());
+    auto range = [](const SentenceIndex &index, size_t v) -> std::pair<Position, Position>{
+        if(v + 1 < index.offsets.size()){
+            return {index.offsets[v], index.offsets[v + 1]};
+        }
+        return {0, 0};
+    };
+    for(size_t v = 0; v < num_keys; v++){
+        auto [a_first, a_last] = range(A, v);
+        auto [b_first, b_last] = range(B, v);
+        C.ids.insert(C.ids.end(), A.ids.begin() + a_first, A.ids.begin() + a_last);
+        for(Position i = b_first; i < b_last; i++){
+            C.ids.push_back(B.ids[i] + offset);
+        }
+        C.offsets[v + 1] = C.ids.size();
+    }
+    return C;
+}
+
+//Merges two indices in linear time, positions in B are moved by offset
+Index merge_index(const Index &A, const Index &B, Position offset, const std::vector<Token> &tokens, uint32_t Token::* attribute){
+    Index C(A.size() + B.size());
+    Position p = 0;
+    Position q = 0;
+    Position r = 0;
+    while(p < (Position)A.size() && q < (Position)B.size()){
+        //On equal values A goes first, since all of its positions come before the ones in B
+        if(tokens[B[q] + offset].*attribute < tokens[A[p]].*attribute){
+            C[r++] = B[q++] + offset;
+        } else{
+            C[r++] = A[p++];
+        }
+    }
+    while(p < (Position)A.size()){
+        C[r++] = A[p++];
+    }
+    while(q < (Position)B.size()){
+        C[r++] = B[q++] + offset;
+    }
+    return C;
+}
+
+//Picks a pair of neighbouring segments to merge, returns the index of the first one or -1 if none should be merged
+int pick_merge(const std::vector<SegmentPtr> &segments){
+    //A segment is merged into its older neighbour once it is at least half as big, this keeps the
+    //number of segments logarithmic and every token is only merged a logarithmic number of times
+    for(int i = (int)segments.size() - 2; i >= 0; i--){
+        if(2 * segments[i + 1]->corpus.tokens.size() >= segments[i]->corpus.tokens.size()){
+            return i;
+        }
+    }
+    return -1;
+}
+
+//Merges one pair of segments, returns false if there was nothing to merge
+bool merge_step(SegmentedCorpus &corpus){
+    std::lock_guard<std::mutex> merging(corpus.merging);
+    std::vector<SegmentPtr> segments = snapshot(corpus);
+    int i = pick_merge(segments);
+    if(i < 0){
+        return false;
+    }
+    //The merge runs without the lock so queries and appends are not blocked
+    SegmentPtr merged = std::make_shared<const Segment>(merge_segments(*segments[i], *segments[i + 1]));
+    std::lock_guard<std::mutex> guard(corpus.lock);
+    //Appends only add segments at the end, so the merged pair is still in the same place
+    corpus.segments[i] = merged;
+    corpus.segments.erase(corpus.segments.begin() + i + 1);
+    return true;
+}
+
+//Merges all segments into one
+void compact(SegmentedCorpus &corpus){
+    std::lock_guard<std::mutex> merging(corpus.merging);
+    std::vector<SegmentPtr> segments = snapshot(corpus);
+    int count = segments.size();
+    if(count <= 1){
+        return;
+    }
+    //Merge neighbours pairwise so every token is copied a logarithmic number of times
+    while(segments.size() > 1){
+        std::vector<SegmentPtr> merged;
+        for(int i = 0; i + 1 < (int)segments.size(); i += 2){
+            merged.push_back(std::make_shared<const Segment>(merge_segments(*segments[i], *segments[i + 1])));
+        }
+        if(segments.size() % 2 == 1){
+            merged.push_back(segments.back());
+        }
+        segments = std::move(merged);
+    }
+    //Segments appended while compacting stay after the compacted one
+    std::lock_guard<std::mutex> guard(corpus.lock);
+    corpus.segments.erase(corpus.segments.begin(), corpus.segments.begin() + count);
+    corpus.segments.insert(corpus.segments.begin(), segments[0]);
+}
+
+//Starts the background merger, it sleeps until an append creates something to merge
+void start_merger(SegmentedCorpus &corpus){
+    corpus.merger = std::jthread([&corpus](std::stop_token stop){
+        while(!stop.stop_requested()){
+            while(!stop.stop_requested() && merge_step(corpus)){}
+            std::unique_lock<std::mutex> guard(corpus.lock);
+            corpus.merge_signal.wait(guard, stop, [&corpus]{ return pick_merge(corpus.segments) >= 0; });
+        }
+    });
+}
+
+//Stops the background merger and waits for the current merge to finish
+void stop_merger(SegmentedCorpus &corpus){
+    if(corpus.merger.joinable()){
+        corpus.merger.request_stop();
+        corpus.merger.join();
+    }
+}
+
+//Parses a query against the shared dictionary
+Query parse_query(const std::string &text, const SegmentedCorpus &corpus){
+    std::lock_guard<std::mutex> guard(corpus.lock);
+    return parse_query(text, corpus.dictionary);
+}
+
+//Get all matches from a query over all segments, sentence ids are global
+std::vector<Match> match2(const SegmentedCorpus &corpus, const Query &query){
+    return match2(snapshot(corpus), query);
+}
+std::vector<Match> match2(const std::vector<SegmentPtr> &segments, const Query &query){
+    std::vector<Match> matches;
+    for(const SegmentPtr &segment: segments){
+        std::vector<Match> m = match2(segment->corpus, query);
+        for(Match &x: m){
+            x.sentence += segment->sentence_offset;
+            matches.push_back(x);
+        }
+    }
+    return matches;
+}
+
+//Sentences of all segments that have a token matching every clause, sentence ids are global
+std::vector<Position> match_sentences(const std::vector<SegmentPtr> &segments, const Query &query){
+    std::vector<Position> sentences;
+    for(const SegmentPtr &segment: segments){
+        for(Position s: match_sentences(segment->corpus, query)){
+            sentences.push_back(s + segment->sentence_offset);
+        }
+    }
+    return sentences;
+}
+
+//Finds the segment that holds a global sentence id
+const Segment &find_segment(const std::vector<SegmentPtr> &segments, Position sentence){
+    auto it = std::upper_bound(segments.begin(), segments.end(), sentence, [](Position s, const SegmentPtr &segment){
+        return s < segment->sentence_offset;});
+    return **(it - 1);
+}
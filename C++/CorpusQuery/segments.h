@@ -0,0 +1,52 @@
+#ifndef SEGMENTS_H
+#define SEGMENTS_H
+#include "query_corpora.h"
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+//An immutable slice of the corpus with its own indices.
+//Token positions and sentence ids inside the corpus are local, the offsets map them to the whole corpus.
+struct Segment
+{
+    Corpus corpus;
+    Position token_offset;
+    Position sentence_offset;
+};
+using SegmentPtr = std::shared_ptr<const Segment>;
+//A corpus made of segments in corpus order. New text is appended as a new small segment
+//and a background merger combines segments of similar size, like an LSM tree.
+struct SegmentedCorpus
+{
+    //Only index2string and string2index are used, so ids are shared by all segments
+    Corpus dictionary;
+    std::vector<SegmentPtr> segments;
+    //New segments get a suffix array over their words
+    bool suffix_array = false;
+    //Guards dictionary and segments
+    mutable std::mutex lock;
+    //Held while merging so the background merger and compact never replace the same segments
+    std::mutex merging;
+    std::condition_variable_any merge_signal;
+    //Declared last so it is stopped and joined before the other members are destroyed
+    std::jthread merger;
+};
+void append_segment(SegmentedCorpus &corpus, const std::string &filename);
+void append_segment(SegmentedCorpus &corpus, std::istream &f);
+std::vector<SegmentPtr> snapshot(const SegmentedCorpus &corpus);
+Position num_tokens(const std::vector<SegmentPtr> &segments);
+Position num_sentences(const std::vector<SegmentPtr> &segments);
+Segment merge_segments(const Segment &A, const Segment &B);
+Index merge_index(const Index &A, const Index &B, Position offset, const std::vector<Token> &tokens, uint32_t Token::* attribute);
+SentenceIndex merge_sentence_index(const SentenceIndex &A, const SentenceIndex &B, Position offset);
+int pick_merge(const std::vector<SegmentPtr> &segments);
+bool merge_step(SegmentedCorpus &corpus);
+void compact(SegmentedCorpus &corpus);
+void start_merger(SegmentedCorpus &corpus);
+void stop_merger(SegmentedCorpus &corpus);
+Query parse_query(const std::string &text, const SegmentedCorpus &corpus);
+std::vector<Match> match2(const SegmentedCorpus &corpus, const Query &query);
+std::vector<Match> match2(const std::vector<SegmentPtr> &segments, const Query &query);
+std::vector<Position> match_sentences(const std::vector<SegmentPtr> &segments, const Query &query);
+const Segment &find_segment(const std::vector<SegmentPtr> &segments, Position sentence);
+#endif
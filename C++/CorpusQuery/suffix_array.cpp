@@ -0,0 +1,168 @@
+#include <algorithm>
+#include "suffix_array.h"
+//Sorts the suffixes of text with SA-IS (Nong, Zhang and Chan) in linear time, values are between 0 and upper.
+//Suffixes are S type if they are smaller than the next suffix and L type otherwise. The leftmost S type
+//suffixes (LMS) are sorted first, by recursing on the string of their ranks, and then induce the order of
+//all other suffixes in two passes over the buckets.
+std::vector<Position> suffix_array(const std::vector<Position> &text, Position upper){
+    Position n = text.size();
+    if(n == 0){
+        return {};
+    }
+    if(n == 1){
+        return {0};
+    }
+    if(n == 2){
+        return text[0] < text[1] ? std::vector<Position>{0, 1} : std::vector<Position>{1, 0};
+    }
+    std::vector<Position> sa(n);
+    std::vector<bool> is_s(n);
+    for(Position i = n - 2; i >= 0; i--){
+        is_s[i] = text[i] == text[i + 1] ? is_s[i + 1] : text[i] < text[i + 1];
+    }
+    //Start of the L type part and of the S type part of every bucket, L type suffixes come first
+    std::vector<Position> start_l(upper + 2, 0);
+    std::vector<Position> start_s(upper + 2, 0);
+    for(Position i = 0; i < n; i++){
+        if(!is_s[i]){
+            start_s[text[i]]++;
+        } else{
+            start_l[text[i] + 1]++;
+        }
+    }
+    for(Position c = 0; c <= upper; c++){
+        start_s[c] += start_l[c];
+        if(c < upper){
+            start_l[c + 1] += start_s[c];
+        }
+    }
+    std::vector<Position> bucket(upper + 2);
+    auto induce = [&](const std::vector<Position> &lms){
+        std::fill(sa.begin(), sa.end(), -1);
+        std::copy(start_s.begin(), start_s.end(), bucket.begin());
+        for(Position d: lms){
+            if(d < n){
+                sa[bucket[text[d]]++] = d;
+            }
+        }
+        std::copy(start_l.begin(), start_l.end(), bucket.begin());
+        sa[bucket[text[n - 1]]++] = n - 1;
+        for(Position i = 0; i < n; i++){
+            Position v = sa[i];
+            if(v >= 1 && !is_s[v - 1]){
+                sa[bucket[text[v - 1]]++] = v - 1;
+            }
+        }
+        std::copy(start_l.begin(), start_l.end(), bucket.begin());
+        for(Position i = n - 1; i >= 0; i--){
+            Position v = sa[i];
+            if(v >= 1 && is_s[v - 1]){
+                sa[--bucket[text[v - 1] + 1]] = v - 1;
+            }
+        }
+    };
+    std::vector<Position> lms_rank(n + 1, -1);
+    std::vector<Position> lms;
+    for(Position i = 1; i < n; i++){
+        if(!is_s[i - 1] && is_s[i]){
+            lms_rank[i] = lms.size();
+            lms.push_back(i);
+        }
+    }
+    Position m = lms.size();
+    induce(lms);
+    if(m == 0){
+        return sa;
+    }
+    std::vector<Position> sorted_lms;
+    sorted_lms.reserve(m);
+    for(Position v: sa){
+        if(lms_rank[v] != -1){
+            sorted_lms.push_back(v);
+        }
+    }
+    //Names the LMS substrings in sorted order, equal substrings get the same name
+    std::vector<Position> names(m);
+    Position name = 0;
+    names[lms_rank[sorted_lms[0]]] = 0;
+    for(Position i = 1; i < m; i++){
+        Position l = sorted_lms[i - 1];
+        Position r = sorted_lms[i];
+        Position end_l = lms_rank[l] + 1 < m ? lms[lms_rank[l] + 1] : n;
+        Position end_r = lms_rank[r] + 1 < m ? lms[lms_rank[r] + 1] : n;
+        bool same = end_l - l == end_r - r;
+        if(same){
+            while(l < end_l && text[l] == text[r]){
+                l++;
+                r++;
+            }
+            same = l < n && r < n && text[l] == text[r];
+        }
+        name += !same;
+        names[lms_rank[sorted_lms[i]]] = name;
+    }
+    std::vector<Position> sorted_names = suffix_array(names, name);
+    for(Position i = 0; i < m; i++){
+        sorted_lms[i] = lms[sorted_names[i]];
+    }
+    induce(sorted_lms);
+    return sa;
+}
+
+//Builds the suffix array of the word ids of a corpus
+void build_suffix_array(Corpus &corpus){
+    std::vector<Position> text(corpus.tokens.size());
+    Position upper = 0;
+    for(Position i = 0; i < (Position)text.size(); i++){
+        text[i] = corpus.tokens[i].word;
+        upper = std::max(upper, text[i]);
+    }
+    corpus.word_suffixes = suffix_array(text, upper);
+}
+
+//True if every clause of the query is a single word equality
+bool is_phrase(const Query &query){
+    return std::all_of(query.begin(), query.end(), [](const Clause &clause){
+        return clause.size() == 1 && clause[0].is_equality && clause[0].attribute == "word";
+    });
+}
+
+//The suffixes that start with a phrase of word ids, their order in the corpus is not sorted.
+//Suffixes shorter than the phrase that are equal to its beginning sort before it.
+std::span<const Position> phrase_range(const Corpus &corpus, const std::vector<uint32_t> &phrase){
+    const std::vector<Token> &tokens = corpus.tokens;
+    Position n = tokens.size();
+    //Compares a suffix with the phrase on the phrase length, negative if the suffix is smaller
+    auto compare = [&](Position suffix){
+        for(size_t k = 0; k < phrase.size(); k++){
+            if(suffix + (Position)k >= n){
+                return -1;
+            }
+            uint32_t w = tokens[suffix + k].word;
+            if(w != phrase[k]){
+                return w < phrase[k] ? -1 : 1;
+            }
+        }
+        return 0;
+    };
+    const std::vector<Position> &sa = corpus.word_suffixes;
+    auto first = std::partition_point(sa.begin(), sa.end(), [&](Position s){ return compare(s) < 0; });
+    auto last = std::partition_point(first, sa.end(), [&](Position s){ return compare(s) == 0; });
+    return std::span<const Position>(first, last);
+}
+
+//The suffixes that start with the words of a phrase query
+std::span<const Position> phrase_range(const Corpus &corpus, const Query &query){
+    std::vector<uint32_t> phrase;
+    for(const Clause &clause: query){
+        phrase.push_back(clause[0].value);
+    }
+    return phrase_range(corpus, phrase);
+}
+
+//The occurrences of a phrase in increasing order
+std::vector<Position> sorted_positions(std::span<const Position> range){
+    std::vector<Position> positions(range.begin(), range.end());
+    std::sort(positions.begin(), positions.end());
+    return positions;
+}
@@ -0,0 +1,15 @@
+#ifndef SUFFIX_ARRAY_H
+#define SUFFIX_ARRAY_H
+#include "query_corpora.h"
+//Suffix array over the word ids of a corpus: the start of every suffix, sorted by the word ids that follow it.
+//All occurrences of a phrase start suffixes that begin with the phrase, so they are next to each other and
+//two binary searches find them all, however many words the phrase has.
+std::vector<Position> suffix_array(const std::vector<Position> &text, Position upper);
+void build_suffix_array(Corpus &corpus);
+//Queries of at least this many clauses that are all one word equality can be looked up in the suffix array
+const int phrase_min_clauses = 2;
+bool is_phrase(const Query &query);
+std::span<const Position> phrase_range(const Corpus &corpus, const std::vector<uint32_t> &phrase);
+std::span<const Position> phrase_range(const Corpus &corpus, const Query &query);
+std::vector<Position> sorted_positions(std::span<const Position> range);
+#endif
@@ -0,0 +1,190 @@
+#include <fstream>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include "views.h"
+const char views_magic[8] = {'C', 'Q', 'V', 'I', 'E', 'W', 'S', '1'};
+
+//Reads literal combinations, one clause per line such as [pos="VERB" lemma="go"]. Empty lines and lines
+//starting with # are skipped. A combination with a value the corpus does not have is left out, it has no
+//posting list to intersect.
+std::vector<Clause> read_combinations(const std::string &filename, const Corpus &corpus){
+    std::ifstream f(filename);
+    if(!f){
+        throw std::invalid_argument("Can not open " + filename);
+    }
+    std::vector<Clause> combinations;
+    std::string line;
+    for(int n = 1; std::getline(f, line); n++){
+        if(!line.empty() && line.back() == '\r'){
+            line.pop_back();
+        }
+        if(line.find_first_not_of(' ') == std::string::npos || line[line.find_first_not_of(' ')] == '#'){
+            continue;
+        }
+        Query q = parse_query(line, corpus);
+        std::string where = "Line " + std::to_string(n) + " of " + filename;
+        if(q.size() != 1){
+            throw std::invalid_argument(where + " is not one clause");
+        }
+        if(q[0].size() < 2){
+            throw std::invalid_argument(where + " has fewer than two literals");
+        }
+        if(std::none_of(q[0].begin(), q[0].end(), [](const Literal &l){ return l.is_equality; })){
+            throw std::invalid_argument(where + " has no equality");
+        }
+        if(std::all_of(q[0].begin(), q[0].end(), [&corpus](const Literal &l){ return l.value < corpus.index2string.size(); })){
+            combinations.push_back(q[0]);
+        }
+    }
+    return combinations;
+}
+
+//Intersects the literals of a combination once, the same way a query of that one clause is evaluated
+MaterializedView build_view(const Corpus &corpus, const Clause &literals){
+    MaterializedView view;
+    view.literals = literals;
+    for_each_position(plan_query(corpus, Query{literals}), [&view](Position t){
+        view.positions.push_back(t);
+    });
+    view.positions.shrink_to_fit();
+    return view;
+}
+
+//Hash of the tokens, sentences and dictionary size. Views saved for a corpus with another fingerprint are
+//rebuilt. The tokens are hashed as 64 bit words, which takes a few milliseconds per million tokens.
+uint64_t corpus_fingerprint(const Corpus &corpus){
+    uint64_t h = 0xcbf29ce484222325ull ^ corpus.index2string.size();
+    auto mix = [&h](const void *data, size_t bytes){
+        const char *p = (const char *)data;
+        for(; bytes >= 8; bytes -= 8, p += 8){
+            uint64_t w;
+            std::memcpy(&w, p, 8);
+            h = (h ^ w) * 0x100000001b3ull;
+            h ^= h >> 29;
+        }
+        for(; bytes > 0; bytes--, p++){
+            h = (h ^ (unsigned char)*p) * 0x100000001b3ull;
+        }
+    };
+    mix(corpus.tokens.data(), corpus.tokens.size() * sizeof(Token));
+    mix(corpus.sentences.data(), corpus.sentences.size() * sizeof(Position));
+    return h;
+}
+
+template <typename T>
+void write_value(std::ofstream &f, const T &x){
+    f.write((const char *)&x, sizeof(x));
+}
+void write_string(std::ofstream &f, const std::string &s){
+    write_value(f, (uint32_t)s.size());
+    f.write(s.data(), s.size());
+}
+template <typename T>
+bool read_value(std::ifstream &f, T &x){
+    return (bool)f.read((char *)&x, sizeof(x));
+}
+bool read_string(std::ifstream &f, std::string &s){
+    uint32_t size;
+    if(!read_value(f, size) || size > (1u << 20)){
+        return false;
+    }
+    s.resize(size);
+    return (bool)f.read(s.data(), size);
+}
+
+//Writes views with their literals as strings, so the file does not depend on the order values were
+//interned in. The header has the width of a position and the fingerprint of the corpus.
+void save_views(const std::string &filename, const Corpus &corpus, const std::vector<MaterializedView> &views){
+    std::ofstream f(filename, std::ios::binary | std::ios::trunc);
+    if(!f){
+        throw std::invalid_argument("Can not write " + filename);
+    }
+    f.write(views_magic, sizeof(views_magic));
+    write_value(f, (uint32_t)sizeof(Position));
+    write_value(f, corpus_fingerprint(corpus));
+    write_value(f, (uint64_t)views.size());
+    for(const MaterializedView &view: views){
+        write_value(f, (uint32_t)view.literals.size());
+        for(const Literal &l: view.literals){
+            write_string(f, l.attribute);
+            write_string(f, corpus.index2string[l.value]);
+            write_value(f, (uint8_t)l.is_equality);
+        }
+        write_value(f, (uint64_t)view.positions.size());
+        f.write((const char *)view.positions.data(), view.positions.size() * sizeof(Position));
+    }
+    if(!f.flush()){
+        throw std::invalid_argument("Can not write " + filename);
+    }
+}
+
+//Reads the views saved for a corpus. Returns false if the file is missing, damaged, was written for
+//another corpus or position width, or does not hold exactly the combinations asked for, in that order.
+bool load_views(const std::string &filename, const Corpus &corpus, const std::vector<Clause> &combinations, std::vector<MaterializedView> &views){
+    std::ifstream f(filename, std::ios::binary);
+    char magic[sizeof(views_magic)];
+    uint32_t width;
+    uint64_t fingerprint, count;
+    if(!f || !f.read(magic, sizeof(magic)) || std::memcmp(magic, views_magic, sizeof(magic)) != 0
+       || !read_value(f, width) || width != sizeof(Position) || !read_value(f, fingerprint)
+       || fingerprint != corpus_fingerprint(corpus) || !read_value(f, count) || count != combinations.size()){
+        return false;
+    }
+    std::vector<MaterializedView> loaded(count);
+    for(uint64_t i = 0; i < count; i++){
+        const Clause &expected = combinations[i];
+        uint32_t literals;
+        if(!read_value(f, literals) || literals != expected.size()){
+            return false;
+        }
+        for(const Literal &l: expected){
+            std::string attribute, value;
+            uint8_t is_equality;
+            if(!read_string(f, attribute) || !read_string(f, value) || !read_value(f, is_equality)
+               || attribute != l.attribute || value != corpus.index2string[l.value] || (bool)is_equality != l.is_equality){
+                return false;
+            }
+        }
+        uint64_t size;
+        if(!read_value(f, size) || size > corpus.tokens.size()){
+            return false;
+        }
+        loaded[i].literals = expected;
+        loaded[i].positions.resize(size);
+        if(!f.read((char *)loaded[i].positions.data(), size * sizeof(Position))){
+            return false;
+        }
+    }
+    views = std::move(loaded);
+    return true;
+}
+
+//Gives a corpus the views of the combinations in a file. They are read from the corpus file name plus
+//views_extension if it is up to date, otherwise built and saved there for the next load.
+ViewReport attach_views(Corpus &corpus, const std::string &corpus_file, const std::string &combinations_file){
+    auto start = std::chrono::steady_clock::now();
+    ViewReport report;
+    report.filename = corpus_file + views_extension;
+    std::vector<Clause> combinations = read_combinations(combinations_file, corpus);
+    std::vector<MaterializedView> views;
+    report.loaded = load_views(report.filename, corpus, combinations, views);
+    if(!report.loaded){
+        for(const Clause &literals: combinations){
+            views.push_back(build_view(corpus, literals));
+        }
+        try{
+            save_views(report.filename, corpus, views);
+        } catch(const std::invalid_argument &e){
+            report.error = e.what();
+        }
+    }
+    corpus.views = std::move(views);
+    report.views = corpus.views.size();
+    for(const MaterializedView &view: corpus.views){
+        report.positions += view.positions.size();
+    }
+    std::chrono::duration<double, std::milli> d = std::chrono::steady_clock::now() - start;
+    report.ms = d.count();
+    return report;
+}
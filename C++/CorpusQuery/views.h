@@ -0,0 +1,26 @@
+#ifndef VIEWS_H
+#define VIEWS_H
+#include "query_corpora.h"
+//Materialized views: the positions of frequent literal combinations are intersected once and kept with
+//the corpus, match_set and the planner read them instead of the posting lists of the literals they cover.
+//They are saved next to the corpus file and loaded again as long as the corpus has not changed.
+struct ViewReport
+{
+    int views = 0;
+    long positions = 0;
+    //True if the views were read from the file instead of built
+    bool loaded = false;
+    double ms = 0;
+    std::string filename;
+    //Set if the views could not be saved, they are still used
+    std::string error;
+};
+//Appended to the corpus file name to get the file its views are saved in
+const std::string views_extension = ".views";
+std::vector<Clause> read_combinations(const std::string &filename, const Corpus &corpus);
+MaterializedView build_view(const Corpus &corpus, const Clause &literals);
+uint64_t corpus_fingerprint(const Corpus &corpus);
+void save_views(const std::string &filename, const Corpus &corpus, const std::vector<MaterializedView> &views);
+bool load_views(const std::string &filename, const Corpus &corpus, const std::vector<Clause> &combinations, std::vector<MaterializedView> &views);
+ViewReport attach_views(Corpus &corpus, const std::string &corpus_file, const std::string &combinations_file);
+#endif